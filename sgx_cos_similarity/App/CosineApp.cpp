@@ -10,14 +10,29 @@
 #include <cstdio>    
 #include <limits.h>
 #include <array>  
+#include <chrono>
+#include <getopt.h>
+#include <sgx_uswitchless.h>
 
 sgx_enclave_id_t global_eid = 0;
 
-// Initialize the enclave
-int initialize_enclave(void)
+// Initialize the enclave; with switchless_workers > 0 the ecalls marked
+// transition_using_threads are served by that many trusted worker threads
+int initialize_enclave(uint32_t switchless_workers)
 {
     sgx_status_t ret = SGX_ERROR_UNEXPECTED;
-    ret = sgx_create_enclave(ENCLAVE_FILE, SGX_DEBUG_FLAG, NULL, NULL, &global_eid, NULL);
+    if (switchless_workers == 0) {
+        ret = sgx_create_enclave(ENCLAVE_FILE, SGX_DEBUG_FLAG, NULL, NULL, &global_eid, NULL);
+    } else {
+        sgx_uswitchless_config_t us_config = SGX_USWITCHLESS_CONFIG_INITIALIZER;
+        us_config.num_uworkers = switchless_workers;
+        us_config.num_tworkers = switchless_workers;
+
+        const void* enclave_ex_p[32] = {0};
+        enclave_ex_p[SGX_CREATE_ENCLAVE_EX_SWITCHLESS_BIT_IDX] = &us_config;
+        ret = sgx_create_enclave_ex(ENCLAVE_FILE, SGX_DEBUG_FLAG, NULL, NULL, &global_eid, NULL,
+                                    SGX_CREATE_ENCLAVE_EX_SWITCHLESS, enclave_ex_p);
+    }
     if (ret != SGX_SUCCESS) {
         printf("Enclave creation failed\n");
         return -1;
@@ -110,9 +125,27 @@ bool validate_query_data(const std::vector<uint8_t>& sealed_data) {
     return true;
 }
 
-int main(void)
+int main(int argc, char* argv[])
 {
-    if (initialize_enclave() < 0) {
+    uint32_t switchless_workers = 0;
+
+    static const struct option long_options[] = {
+        {"switchless-workers", required_argument, NULL, 'w'},
+        {NULL, 0, NULL, 0}
+    };
+
+    int opt;
+    while ((opt = getopt_long(argc, argv, "w:", long_options, NULL)) != -1) {
+        if (opt == 'w' && atoi(optarg) >= 0 && atoi(optarg) <= MAX_SWITCHLESS_WORKERS) {
+            switchless_workers = (uint32_t)atoi(optarg);
+        } else {
+            printf("Usage: %s [--switchless-workers N]  (N = 0-%d, default 0 = off)\n",
+                   argv[0], MAX_SWITCHLESS_WORKERS);
+            return -1;
+        }
+    }
+
+    if (initialize_enclave(switchless_workers) < 0) {
         printf("Enclave initialization failed.\n");
         return -1;
     }
@@ -172,11 +205,13 @@ int main(void)
 
     // Compute cosine similarity
     float similarity;
+    auto query_start = std::chrono::high_resolution_clock::now();
     status = ecall_compute_cosine_similarity(
         global_eid,
         &similarity,
         query_data->vector.data()
     );
+    auto query_end = std::chrono::high_resolution_clock::now();
 
     if (status != SGX_SUCCESS) {
         printf("Enclave call failed with status: %d\n", status);
@@ -194,6 +229,10 @@ int main(void)
         printf("Error: Invalid similarity value: %f\n", similarity);
     }
 
+    printf("Query latency: %ld us (switchless workers: %u)\n",
+           (long)std::chrono::duration_cast<std::chrono::microseconds>(query_end - query_start).count(),
+           switchless_workers);
+
     // Cleanup
     ecall_cleanup_reference_vectors(global_eid);
     sgx_destroy_enclave(global_eid);
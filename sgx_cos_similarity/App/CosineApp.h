@@ -6,5 +6,6 @@
 #include "sgx_urts.h"
 
 #define ENCLAVE_FILE "sgx_cosine_sim.signed.so"
+#define MAX_SWITCHLESS_WORKERS 3  // TCSNum in CosineEnclave.config.xml minus the main thread
 
 #endif
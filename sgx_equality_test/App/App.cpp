@@ -1,6 +1,7 @@
 // App.cpp
 #include "App.h"
 #include "Enclave_u.h"
+#include "Service.h"
 #include "shared_types.h"
 #include <string>
 #include <vector>
@@ -8,6 +9,7 @@
 #include <chrono>
 #include <sgx_urts.h>
 #include <sgx_eid.h>
+#include <sgx_uswitchless.h>
 #include <algorithm>
 #include <numeric>
 #include <iomanip>
@@ -15,28 +17,35 @@
 #include <openssl/err.h>
 #include <openssl/rand.h>
 #include <unistd.h>  
+#include <getopt.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <stdarg.h>
 #include <stdio.h>
+#include <string.h>
 #include <memory>
 #include <system_error>
+#include <thread>
+#include <atomic>
 #include <sgx_tcrypto.h>
 
-#define AES_KEY_SIZE 16
-#define AES_BLOCK_SIZE 16
-#define MAX_FILE_SIZE (256 * 1024 * 1024)
+#define DEFAULT_BATCH_SIZE 65536  // Test values per ecall_check_numbers_batch call
+#define ENCLAVE_TCS_NUM 16  // TCSNum in Enclave.config.xml
+#define MAX_SWITCHLESS_WORKERS 3  // Worker threads per side
+#define MAX_QUERY_THREADS ENCLAVE_TCS_NUM
+#define MAX_INGEST_THREADS (ENCLAVE_TCS_NUM - MAX_SWITCHLESS_WORKERS)  // Shards copied in at once
+#define DEFAULT_SERVICE_SECRET_FILE "tools/sealed_data/secret_numbers1.dat"
 
 sgx_enclave_id_t global_eid = 0;
 
-struct TestResults {
-    int matches;
-    int non_matches;
-    int errors;
-    uint64_t total_time_us;
-    uint64_t processing_time_us;
-    uint64_t encryption_time_us;
-    uint64_t decryption_time_us;  
-    uint64_t overhead_time_us;
-    uint64_t page_faults;
+// How run_test_iteration feeds the test values to the enclave
+struct RunConfig {
+    size_t batch_size;  // Values per ecall_check_numbers_batch call, 0 = one call per value
+    bool pipeline;      // Decrypt, check and encrypt inside a single enclave call
+    uint32_t threads;   // Host threads splitting the test values, each on its own TCS
+    uint32_t result_mode;  // RESULT_MODE_* the enclave was set to
+    bool payloads;      // Look up each test value's payload in a keyed set instead
 };
 
 void cleanup_resources() {
@@ -62,16 +71,13 @@ bool initialize_encryption_key() {
             return false;
         }
 
-        alignas(16) uint8_t aligned_key[AES_KEY_SIZE];
-        alignas(16) uint8_t aligned_counter[AES_BLOCK_SIZE];
-        memcpy(aligned_key, key_data.data(), AES_KEY_SIZE);
-        memcpy(aligned_counter, key_data.data() + AES_KEY_SIZE, AES_BLOCK_SIZE);
-
+        // Key followed by the counter; compact query files never send a
+        // counter of their own, so this one must arrive intact
         sgx_status_t ret_status;
         sgx_status_t status = ecall_initialize_aes_key(
             global_eid,
             &ret_status,
-            aligned_key,
+            key_data.data(),
             AES_KEY_SIZE + AES_BLOCK_SIZE
         );
 
@@ -82,11 +88,51 @@ bool initialize_encryption_key() {
     }
 }
 
-int initialize_enclave() {
-    sgx_status_t ret = sgx_create_enclave(ENCLAVE_FILE, SGX_DEBUG_FLAG, NULL, NULL, &global_eid, NULL);
+// With switchless_workers > 0 the ecalls and ocalls marked transition_using_threads
+// in Enclave.edl are handed to that many untrusted and trusted worker threads
+// instead of doing an EENTER/EEXIT; each trusted worker occupies a TCS
+int initialize_enclave(uint32_t switchless_workers) {
+    sgx_status_t ret;
+    if (switchless_workers == 0) {
+        ret = sgx_create_enclave(ENCLAVE_FILE, SGX_DEBUG_FLAG, NULL, NULL, &global_eid, NULL);
+    } else {
+        sgx_uswitchless_config_t us_config = SGX_USWITCHLESS_CONFIG_INITIALIZER;
+        us_config.num_uworkers = switchless_workers;
+        us_config.num_tworkers = switchless_workers;
+
+        const void* enclave_ex_p[32] = {0};
+        enclave_ex_p[SGX_CREATE_ENCLAVE_EX_SWITCHLESS_BIT_IDX] = &us_config;
+        ret = sgx_create_enclave_ex(ENCLAVE_FILE, SGX_DEBUG_FLAG, NULL, NULL, &global_eid, NULL,
+                                    SGX_CREATE_ENCLAVE_EX_SWITCHLESS, enclave_ex_p);
+    }
     return (ret == SGX_SUCCESS) ? 0 : -1;
 }
 
+static bool query_header_matches(const uint8_t* header_bytes, size_t file_size) {
+    QueryFileHeader header;
+    memcpy(&header, header_bytes, sizeof(header));
+    return (header.magic == QUERY_FILE_MAGIC && header.chunk_values != 0 &&
+            header.key_type < KEY_TYPE_COUNT && header.count <= MAX_VALUES &&
+            header.chunk_values <= QUERY_MAX_CHUNK_VALUES &&
+            file_size == QUERY_FILE_SIZE(header.count, header.chunk_values, header.key_type));
+}
+
+// True if data looks like a compact query file (see QueryFileHeader); the
+// enclave authenticates every chunk before using it
+bool is_query_file(const uint8_t* data, size_t size) {
+    return size >= sizeof(QueryFileHeader) && query_header_matches(data, size);
+}
+
+// Legacy TestData files hold 32-bit values
+static bool is_int32_query_file(const std::vector<uint8_t>& data) {
+    if (!is_query_file(data.data(), data.size())) {
+        return true;
+    }
+    return reinterpret_cast<const QueryFileHeader*>(data.data())->key_type == KEY_TYPE_INT32;
+}
+
+// Test files are either a compact query file, returned whole, or the legacy
+// counter plus encrypted TestData, whose counter goes straight to the enclave
 bool load_sealed_data(const std::string& filename, std::vector<uint8_t>& sealed_data, bool is_test_data) {
     try {
         std::ifstream sealed_file(filename, std::ios::binary);
@@ -102,22 +148,30 @@ bool load_sealed_data(const std::string& filename, std::vector<uint8_t>& sealed_
             return false;
         }
 
+        size_t prefix_size = 0;
         if (is_test_data) {
+            // The query file header and the legacy counter are the same size
             std::vector<uint8_t> counter(AES_BLOCK_SIZE);
             if (!sealed_file.read(reinterpret_cast<char*>(counter.data()), AES_BLOCK_SIZE)) {
                 return false;
             }
 
-            sgx_status_t ret_status;
-            if (ecall_update_counter(global_eid, &ret_status, counter.data(), AES_BLOCK_SIZE) != SGX_SUCCESS) {
-                return false;
+            if (query_header_matches(counter.data(), total_file_size)) {
+                sealed_data.assign(counter.begin(), counter.end());
+                prefix_size = AES_BLOCK_SIZE;
+            } else {
+                sgx_status_t ret_status;
+                if (ecall_update_counter(global_eid, &ret_status, counter.data(), AES_BLOCK_SIZE) != SGX_SUCCESS) {
+                    return false;
+                }
+                sealed_data.clear();
             }
         }
 
         size_t data_size = total_file_size - (is_test_data ? AES_BLOCK_SIZE : 0);
-        sealed_data.resize(data_size);
+        sealed_data.resize(prefix_size + data_size);
 
-        if (!sealed_file.read(reinterpret_cast<char*>(sealed_data.data()), data_size)) {
+        if (!sealed_file.read(reinterpret_cast<char*>(sealed_data.data() + prefix_size), data_size)) {
             return false;
         }
 
@@ -128,79 +182,311 @@ bool load_sealed_data(const std::string& filename, std::vector<uint8_t>& sealed_
     }
 }
 
-bool validate_sealed_data(const std::vector<uint8_t>& sealed_data, const char* type) {
-    if (sealed_data.size() != sizeof(SecretData)) {
+bool read_key_file(std::vector<uint8_t>& key_data) {
+    std::ifstream key_file("aes.key", std::ios::binary);
+    if (!key_file) {
         return false;
     }
 
-    const auto* data = reinterpret_cast<const SecretData*>(sealed_data.data());
-    return (data->version == CURRENT_VERSION && data->count > 0 && data->count <= MAX_VALUES);
+    key_data.resize(AES_KEY_SIZE + AES_BLOCK_SIZE);
+    return (bool)key_file.read(reinterpret_cast<char*>(key_data.data()), key_data.size());
 }
 
-TestResults run_test_iteration(const std::string& secret_file, const std::string& test_file) {
-    TestResults results = {0, 0, 0, 0, 0, 0, 0, 0, 0};
-    auto total_start = std::chrono::high_resolution_clock::now();
+// Streams a secret set file into the enclave INGEST_CHUNK_VALUES at a time, so
+// neither side ever holds more than the header and count values
+static bool stream_secret_set(uint32_t set_id, const std::string& secret_file) {
+    std::ifstream file(secret_file, std::ios::binary);
+    SecretDataHeader header;
+    if (!file || !file.read(reinterpret_cast<char*>(&header), SECRET_DATA_HEADER_SIZE)) {
+        return false;
+    }
 
-    sgx_status_t timing_reset_status;
-    if (ecall_reset_timing(global_eid, &timing_reset_status) != SGX_SUCCESS) {
-        return results;
+    uint32_t count = header.count;
+    bool keyed = (header.version == SECRET_DATA_VERSION_KEYED);
+    if ((header.version != CURRENT_VERSION && !keyed) || header.key_type >= KEY_TYPE_COUNT ||
+        count == 0 || count > MAX_VALUES) {
+        return false;
     }
 
-    std::vector<uint8_t> secret_data;
-    if (!load_sealed_data(secret_file, secret_data, false) || 
-        !validate_sealed_data(secret_data, "secret")) {
-        return results;
+    sgx_status_t ret_status;
+    if (ecall_begin_secret_data(global_eid, &ret_status, set_id, header.key_type, count, keyed) !=
+        SGX_SUCCESS || ret_status != SGX_SUCCESS) {
+        return false;
     }
 
-    sgx_status_t init_ret_status;
-    if (ecall_initialize_secret_data(global_eid, &init_ret_status, 
-        secret_data.data(), secret_data.size()) != SGX_SUCCESS) {
-        return results;
+    // The values, then the payloads of a keyed set
+    size_t key_size = KEY_TYPE_SIZE(header.key_type);
+    uint32_t chunk_values = std::min(count, (uint32_t)INGEST_CHUNK_VALUES);
+    std::vector<uint8_t> chunk((size_t)chunk_values * key_size);
+    for (int part = 0; part < (keyed ? 2 : 1); part++) {
+        size_t entry_size = (part == 0) ? key_size : PAYLOAD_SIZE;
+        for (uint32_t offset = 0; offset < count; offset += chunk_values) {
+            size_t size = (size_t)std::min(count - offset, chunk_values) * entry_size;
+            if (!file.read(reinterpret_cast<char*>(chunk.data()), size)) {
+                return false;
+            }
+
+            sgx_status_t status = (part == 0) ?
+                ecall_append_secret_data(global_eid, &ret_status, chunk.data(), size) :
+                ecall_append_secret_payloads(global_eid, &ret_status, chunk.data(), size);
+            if (status != SGX_SUCCESS || ret_status != SGX_SUCCESS) {
+                return false;
+            }
+        }
     }
 
-    std::vector<uint8_t> encrypted_test_data;
-    if (!load_sealed_data(test_file, encrypted_test_data, true)) {
-        return results;
+    return (ecall_commit_secret_data(global_eid, &ret_status) == SGX_SUCCESS &&
+            ret_status == SGX_SUCCESS);
+}
+
+// The shard files a secret set is split into when secret_file itself does not
+// exist: secret_file.0, secret_file.1, ... up to the first one missing. Empty
+// for a set held in one file.
+static std::vector<std::string> secret_shard_files(const std::string& secret_file) {
+    std::vector<std::string> shard_files;
+    struct stat file_stat;
+    if (stat(secret_file.c_str(), &file_stat) == 0) {
+        return shard_files;
     }
 
-    std::vector<uint8_t> decrypted_test_data(encrypted_test_data.size());
-    sgx_status_t decrypt_ret_status;
+    for (;;) {
+        std::string shard_file = secret_file + "." + std::to_string(shard_files.size());
+        if (stat(shard_file.c_str(), &file_stat) != 0) {
+            return shard_files;
+        }
+        shard_files.push_back(shard_file);
+    }
+}
 
-    if (ecall_decrypt_test_data(global_eid, &decrypt_ret_status,
-        encrypted_test_data.data(), encrypted_test_data.size(),
-        decrypted_test_data.data(), decrypted_test_data.size()) != SGX_SUCCESS) {
-        return results;
+// Modification time of a secret set, the latest of its shards if it is split
+bool secret_set_mtime(const std::string& secret_file, time_t* mtime) {
+    std::vector<std::string> files = secret_shard_files(secret_file);
+    if (files.empty()) {
+        files.push_back(secret_file);
     }
 
-    const TestData* test_data = reinterpret_cast<const TestData*>(decrypted_test_data.data());
-    if (test_data->version != CURRENT_VERSION || test_data->count == 0 || 
-        test_data->count > MAX_VALUES) {
-        return results;
+    *mtime = 0;
+    for (const std::string& file : files) {
+        struct stat file_stat;
+        if (stat(file.c_str(), &file_stat) != 0) {
+            return false;
+        }
+        *mtime = std::max(*mtime, file_stat.st_mtime);
     }
+    return true;
+}
 
-    EVP_CIPHER_CTX *ctx = EVP_CIPHER_CTX_new();
-    if (!ctx) {
-        return results;
+// Maps one shard file read-only and has the enclave copy shard out of it; a
+// file that cannot be mapped is read into host memory instead
+static bool ingest_secret_shard(uint32_t shard, const std::string& shard_file) {
+    int fd = open(shard_file.c_str(), O_RDONLY);
+    if (fd < 0) {
+        return false;
     }
 
-    std::ifstream key_file("aes.key", std::ios::binary);
-    if (!key_file) {
-        EVP_CIPHER_CTX_free(ctx);
-        return results;
+    struct stat file_stat;
+    if (fstat(fd, &file_stat) != 0 || file_stat.st_size <= 0 ||
+        (uint64_t)file_stat.st_size > MAX_FILE_SIZE) {
+        close(fd);
+        return false;
     }
 
-    std::vector<uint8_t> key_data(AES_KEY_SIZE + AES_BLOCK_SIZE);
-    if (!key_file.read(reinterpret_cast<char*>(key_data.data()), key_data.size())) {
-        EVP_CIPHER_CTX_free(ctx);
-        return results;
+    size_t file_size = (size_t)file_stat.st_size;
+    void* file = mmap(NULL, file_size, PROT_READ, MAP_PRIVATE | MAP_POPULATE, fd, 0);
+    std::vector<uint8_t> contents;
+    if (file == MAP_FAILED) {
+        contents.resize(file_size);
+        if (pread(fd, contents.data(), file_size, 0) != (ssize_t)file_size) {
+            close(fd);
+            return false;
+        }
+    }
+    close(fd);
+
+    const uint8_t* data = (file == MAP_FAILED) ? contents.data() : static_cast<const uint8_t*>(file);
+    sgx_status_t ret_status;
+    bool ingested = (ecall_ingest_secret_shard(global_eid, &ret_status, shard, data, file_size) ==
+                     SGX_SUCCESS && ret_status == SGX_SUCCESS);
+    if (file != MAP_FAILED) {
+        munmap(file, file_size);
+    }
+    return ingested;
+}
+
+// Loads a set split into sorted shard files. The enclave reserves the whole
+// set from the shard headers, up to MAX_INGEST_THREADS threads then copy in
+// the shards, each entering the enclave on its own TCS, and the enclave
+// merges them in one pass without re-sorting.
+static bool load_secret_shards(uint32_t set_id, const std::vector<std::string>& shard_files) {
+    if (shard_files.size() > MAX_SECRET_SHARDS) {
+        return false;
+    }
+
+    std::vector<uint32_t> shard_counts;
+    uint32_t key_type = KEY_TYPE_INT32;
+    for (size_t i = 0; i < shard_files.size(); i++) {
+        std::ifstream file(shard_files[i], std::ios::binary);
+        SecretDataHeader header;
+        if (!file || !file.read(reinterpret_cast<char*>(&header), SECRET_DATA_HEADER_SIZE) ||
+            header.version != CURRENT_VERSION || (i > 0 && header.key_type != key_type)) {
+            return false;
+        }
+        key_type = header.key_type;
+        shard_counts.push_back(header.count);
+    }
+
+    sgx_status_t ret_status;
+    if (ecall_begin_secret_shards(global_eid, &ret_status, set_id, key_type, shard_counts.data(),
+                                  (uint32_t)shard_counts.size()) != SGX_SUCCESS ||
+        ret_status != SGX_SUCCESS) {
+        return false;
     }
 
-    for (uint32_t i = 0; i < test_data->count; i++) {
+    std::atomic<uint32_t> next_shard(0);
+    std::atomic<bool> failed(false);
+    std::vector<std::thread> workers;
+    uint32_t threads = std::min((uint32_t)shard_files.size(), (uint32_t)MAX_INGEST_THREADS);
+    for (uint32_t t = 0; t < threads; t++) {
+        workers.emplace_back([&shard_files, &next_shard, &failed]() {
+            for (uint32_t shard = next_shard++; shard < shard_files.size() && !failed;
+                 shard = next_shard++) {
+                if (!ingest_secret_shard(shard, shard_files[shard])) {
+                    failed = true;
+                }
+            }
+        });
+    }
+
+    for (std::thread& worker : workers) {
+        worker.join();
+    }
+
+    if (!failed && ecall_commit_secret_shards(global_eid, &ret_status) == SGX_SUCCESS &&
+        ret_status == SGX_SUCCESS) {
+        return true;
+    }
+
+    // Otherwise the staged shards would stay pinned in the enclave
+    ecall_abort_secret_ingest(global_eid, &ret_status);
+    return false;
+}
+
+// Maps the secret set file read-only and lets the enclave copy the values
+// straight out of the page cache; falls back to streaming if it cannot be
+// mapped. A set split into shard files is merged from them instead.
+bool load_secret_set(uint32_t set_id, const std::string& secret_file) {
+    std::vector<std::string> shard_files = secret_shard_files(secret_file);
+    if (!shard_files.empty()) {
+        return load_secret_shards(set_id, shard_files);
+    }
+
+    int fd = open(secret_file.c_str(), O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+
+    struct stat file_stat;
+    if (fstat(fd, &file_stat) != 0 || file_stat.st_size <= 0 ||
+        (uint64_t)file_stat.st_size > MAX_FILE_SIZE) {
+        close(fd);
+        return false;
+    }
+
+    size_t file_size = (size_t)file_stat.st_size;
+    void* file = mmap(NULL, file_size, PROT_READ, MAP_PRIVATE | MAP_POPULATE, fd, 0);
+    close(fd);
+    if (file == MAP_FAILED) {
+        return stream_secret_set(set_id, secret_file);
+    }
+
+    sgx_status_t ret_status;
+    bool loaded = (ecall_ingest_secret_file(global_eid, &ret_status, set_id,
+                   static_cast<const uint8_t*>(file), file_size) == SGX_SUCCESS &&
+                   ret_status == SGX_SUCCESS);
+    munmap(file, file_size);
+    return loaded;
+}
+
+// Seals a loaded set and its built index to snapshot_file one chunk at a
+// time; the file is written under a temporary name and renamed into place
+bool save_index_snapshot(uint32_t set_id, const std::string& snapshot_file) {
+    std::string temp_file = snapshot_file + ".tmp";
+    std::ofstream file(temp_file, std::ios::binary | std::ios::trunc);
+    if (!file) {
+        return false;
+    }
+
+    std::vector<uint8_t> sealed(SNAPSHOT_SEALED_CHUNK_MAX);
+    uint32_t chunk_count = 1;
+    for (uint32_t chunk = 0; chunk < chunk_count; chunk++) {
+        uint32_t sealed_size = 0;
+        sgx_status_t ret_status;
+        if (ecall_export_index_snapshot(global_eid, &ret_status, set_id, chunk, sealed.data(),
+                                        sealed.size(), &sealed_size, &chunk_count) != SGX_SUCCESS ||
+            ret_status != SGX_SUCCESS || sealed_size > sealed.size()) {
+            file.close();
+            unlink(temp_file.c_str());
+            return false;
+        }
+
+        if (chunk == 0) {
+            file.write(reinterpret_cast<const char*>(&chunk_count), sizeof(chunk_count));
+        }
+        file.write(reinterpret_cast<const char*>(&sealed_size), sizeof(sealed_size));
+        file.write(reinterpret_cast<const char*>(sealed.data()), sealed_size);
+    }
+
+    file.close();
+    if (!file || rename(temp_file.c_str(), snapshot_file.c_str()) != 0) {
+        unlink(temp_file.c_str());
+        return false;
+    }
+    return true;
+}
+
+// Restores a set and index saved by save_index_snapshot under set_id; fails if
+// the snapshot was taken with a different lookup engine than the current one
+bool load_index_snapshot(uint32_t set_id, const std::string& snapshot_file) {
+    std::ifstream file(snapshot_file, std::ios::binary);
+    uint32_t chunk_count = 0;
+    if (!file || !file.read(reinterpret_cast<char*>(&chunk_count), sizeof(chunk_count)) ||
+        chunk_count == 0) {
+        return false;
+    }
+
+    std::vector<uint8_t> sealed(SNAPSHOT_SEALED_CHUNK_MAX);
+    for (uint32_t chunk = 0; chunk < chunk_count; chunk++) {
+        uint32_t sealed_size = 0;
+        if (!file.read(reinterpret_cast<char*>(&sealed_size), sizeof(sealed_size)) ||
+            sealed_size > sealed.size() ||
+            !file.read(reinterpret_cast<char*>(sealed.data()), sealed_size)) {
+            return false;
+        }
+
+        sgx_status_t ret_status;
+        uint32_t chunks_left = 0;
+        if (ecall_import_index_snapshot(global_eid, &ret_status, set_id, chunk, sealed.data(),
+                                        sealed_size, &chunks_left) != SGX_SUCCESS ||
+            ret_status != SGX_SUCCESS ||
+            chunks_left != chunk_count - chunk - 1) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Checks test values [begin, end) with one enclave transition and host-side
+// decrypt per value
+static void check_values_single(uint32_t set_id,
+                                const std::vector<int>& values, uint32_t begin, uint32_t end,
+                                const std::vector<uint8_t>& key_data,
+                                EVP_CIPHER_CTX* ctx, TestResults& results) {
+    for (uint32_t i = begin; i < end; i++) {
         alignas(16) uint8_t encrypted_result[AES_BLOCK_SIZE];
         sgx_status_t check_ret_status;
 
-        if (ecall_check_number_encrypted(global_eid, &check_ret_status,
-            test_data->values[i], encrypted_result, AES_BLOCK_SIZE) != SGX_SUCCESS) {
+        if (ecall_check_number_encrypted(global_eid, &check_ret_status, set_id,
+            values[i], encrypted_result, AES_BLOCK_SIZE) != SGX_SUCCESS) {
             results.errors++;
             continue;
         }
@@ -230,6 +516,310 @@ TestResults run_test_iteration(const std::string& secret_file, const std::string
             results.non_matches++;
         }
     }
+}
+
+// Decrypts size bytes of one encrypted enclave result (see RESULT_MODE_SIZE)
+// into result
+static bool decrypt_result(const std::vector<uint8_t>& key_data, EVP_CIPHER_CTX* ctx,
+                           const uint8_t* encrypted_results, uint8_t* result, size_t size) {
+    const uint8_t* iv = encrypted_results;
+    const uint8_t* tag = encrypted_results + RESULT_IV_SIZE;
+
+    if (EVP_DecryptInit_ex(ctx, EVP_aes_128_gcm(), NULL, NULL, NULL) != 1 ||
+        EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_GCM_SET_IVLEN, RESULT_IV_SIZE, NULL) != 1 ||
+        EVP_DecryptInit_ex(ctx, NULL, NULL, key_data.data(), iv) != 1) {
+        return false;
+    }
+
+    int len;
+    if (EVP_DecryptUpdate(ctx, result, &len, encrypted_results + RESULT_HEADER_SIZE,
+        (int)size) != 1) {
+        return false;
+    }
+
+    // Final fails unless the tag authenticates the whole result
+    int final_len;
+    return EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_GCM_SET_TAG, RESULT_TAG_SIZE, (void*)tag) == 1 &&
+           EVP_DecryptFinal_ex(ctx, result + len, &final_len) == 1;
+}
+
+// Adds the bits of a decrypted result bitmap over count values to the match
+// counts. Bits past count in the last byte are always zero.
+static void tally_bitmap(const uint8_t* bitmap, size_t count, TestResults& results) {
+    size_t matches = 0;
+    for (size_t i = 0; i < RESULT_BITMAP_BYTES(count); i++) {
+        matches += __builtin_popcount(bitmap[i]);
+    }
+    results.matches += matches;
+    results.non_matches += count - matches;
+}
+
+// Decrypts the result of one batched enclave call over count values and adds
+// it to the match counts. A bitmap (RESULT_MODE_BITMAP) is decrypted into
+// bitmap, RESULT_BITMAP_BYTES(count) long, and its bits counted; a
+// cardinality adds its count. A threshold result leaves matches at 1 if the
+// threshold was reached and 0 if not, with no non-matches.
+bool decrypt_and_tally_results(const std::vector<uint8_t>& key_data, EVP_CIPHER_CTX* ctx,
+                               const uint8_t* encrypted_results, size_t count, uint32_t result_mode,
+                               uint8_t* bitmap, TestResults& results) {
+    if (result_mode != RESULT_MODE_BITMAP) {
+        ResultSummary summary;
+        if (!decrypt_result(key_data, ctx, encrypted_results, (uint8_t*)&summary, sizeof(summary)) ||
+            summary.mode != result_mode ||
+            (result_mode == RESULT_MODE_CARDINALITY ? summary.value > count : summary.value > 1)) {
+            return false;
+        }
+
+        if (result_mode == RESULT_MODE_THRESHOLD) {
+            results.matches = (int)summary.value;
+        } else {
+            results.matches += summary.value;
+            results.non_matches += count - summary.value;
+        }
+        return true;
+    }
+
+    size_t bitmap_size = RESULT_BITMAP_BYTES(count);
+    if (!decrypt_result(key_data, ctx, encrypted_results, bitmap, bitmap_size)) {
+        return false;
+    }
+
+    tally_bitmap(bitmap, count, results);
+    return true;
+}
+
+// Checks test values [begin, end) in chunks of batch_size, paying one enclave
+// transition and one host-side decrypt per chunk instead of per value
+static void check_values_batched(uint32_t set_id,
+                                 const std::vector<int>& values, uint32_t begin, uint32_t end,
+                                 const std::vector<uint8_t>& key_data,
+                                 EVP_CIPHER_CTX* ctx, size_t batch_size, uint32_t result_mode,
+                                 TestResults& results) {
+    std::vector<uint8_t> encrypted_results(RESULT_MODE_SIZE(result_mode, batch_size));
+    std::vector<uint8_t> bitmap(result_mode == RESULT_MODE_BITMAP ? RESULT_BITMAP_BYTES(batch_size) : 0);
+
+    size_t batch_count = 0;
+    for (uint32_t offset = begin; offset < end; offset += batch_count) {
+        batch_count = std::min(batch_size, (size_t)(end - offset));
+        sgx_status_t check_ret_status;
+
+        if (ecall_check_numbers_batch(global_eid, &check_ret_status, set_id,
+            &values[offset], batch_count,
+            encrypted_results.data(), RESULT_MODE_SIZE(result_mode, batch_count)) != SGX_SUCCESS ||
+            check_ret_status != SGX_SUCCESS) {
+            results.errors += batch_count;
+            continue;
+        }
+
+        if (!decrypt_and_tally_results(key_data, ctx, encrypted_results.data(), batch_count,
+                                       result_mode, bitmap.data(), results)) {
+            results.errors += batch_count;
+        }
+    }
+}
+
+static void check_values_range(uint32_t set_id,
+                               const std::vector<int>& values, uint32_t begin, uint32_t end,
+                               const std::vector<uint8_t>& key_data, EVP_CIPHER_CTX* ctx,
+                               size_t batch_size, uint32_t result_mode, TestResults& results) {
+    if (batch_size == 0) {
+        check_values_single(set_id, values, begin, end, key_data, ctx, results);
+    } else {
+        check_values_batched(set_id, values, begin, end, key_data, ctx, batch_size, result_mode,
+                             results);
+    }
+}
+
+// Splits the test values into one contiguous range per thread. Each thread
+// enters the enclave on its own TCS and decrypts its results with its own
+// cipher context; the match counts are summed once all have finished.
+static void check_values_parallel(uint32_t set_id, const std::vector<int>& values,
+                                  const std::vector<uint8_t>& key_data,
+                                  size_t batch_size, uint32_t result_mode, uint32_t threads,
+                                  TestResults& results) {
+    std::vector<TestResults> partial(threads);
+    std::vector<std::thread> workers;
+    uint32_t count = (uint32_t)values.size();
+    uint32_t per_thread = (count + threads - 1) / threads;
+
+    for (uint32_t t = 0; t < threads; t++) {
+        uint32_t begin = std::min(count, t * per_thread);
+        uint32_t end = std::min(count, begin + per_thread);
+        TestResults& part = partial[t];
+
+        workers.emplace_back([set_id, &values, begin, end, &key_data, batch_size, result_mode,
+                              &part]() {
+            EVP_CIPHER_CTX* ctx = EVP_CIPHER_CTX_new();
+            if (!ctx) {
+                part.errors += end - begin;
+                return;
+            }
+            check_values_range(set_id, values, begin, end, key_data, ctx, batch_size, result_mode,
+                               part);
+            EVP_CIPHER_CTX_free(ctx);
+        });
+    }
+
+    for (std::thread& worker : workers) {
+        worker.join();
+    }
+
+    for (const TestResults& part : partial) {
+        results.matches += part.matches;
+        results.non_matches += part.non_matches;
+        results.errors += part.errors;
+    }
+}
+
+// Hands the still-encrypted test file to the enclave, which decrypts, checks
+// and encrypts the results in one call; plaintext test values never leave it,
+// and the host decrypts a single result
+static void check_values_pipelined(uint32_t set_id, const std::vector<uint8_t>& encrypted_test_data,
+                                   const std::vector<uint8_t>& key_data, EVP_CIPHER_CTX* ctx,
+                                   uint32_t result_mode, TestResults& results) {
+    bool bitmap_mode = (result_mode == RESULT_MODE_BITMAP);
+    std::vector<uint8_t> encrypted_results(RESULT_MODE_SIZE(result_mode, MAX_VALUES));
+    std::vector<uint8_t> bitmap(bitmap_mode ? RESULT_BITMAP_BYTES(MAX_VALUES) : 0);
+    uint32_t result_count = 0;
+    sgx_status_t ret_status;
+
+    sgx_status_t status;
+    if (is_query_file(encrypted_test_data.data(), encrypted_test_data.size())) {
+        status = ecall_process_query_file(global_eid, &ret_status, set_id,
+            encrypted_test_data.data(), encrypted_test_data.size(),
+            encrypted_results.data(), encrypted_results.size(), &result_count);
+    } else {
+        status = ecall_process_encrypted_queries(global_eid, &ret_status, set_id,
+            encrypted_test_data.data(), encrypted_test_data.size(),
+            encrypted_results.data(), encrypted_results.size(), &result_count);
+    }
+
+    if (status != SGX_SUCCESS || ret_status != SGX_SUCCESS) {
+        results.errors++;
+        return;
+    }
+
+    if (!decrypt_and_tally_results(key_data, ctx, encrypted_results.data(), result_count,
+                                   result_mode, bitmap.data(), results)) {
+        results.errors += result_count;
+    }
+}
+
+// Has the enclave join the still-encrypted query file against a keyed set and
+// return every query's payload in one encrypted result. The matches are
+// tallied from its bitmap; the payloads follow it, 0 for non-matches.
+static void check_payloads_pipelined(uint32_t set_id, const std::vector<uint8_t>& encrypted_test_data,
+                                     const std::vector<uint8_t>& key_data, EVP_CIPHER_CTX* ctx,
+                                     TestResults& results) {
+    if (!is_query_file(encrypted_test_data.data(), encrypted_test_data.size())) {
+        results.errors++;
+        return;
+    }
+
+    const QueryFileHeader* header =
+        reinterpret_cast<const QueryFileHeader*>(encrypted_test_data.data());
+    std::vector<uint8_t> encrypted_results(PAYLOAD_RESULT_SIZE(header->count));
+    uint32_t result_count = 0;
+    sgx_status_t ret_status;
+    if (ecall_lookup_payloads(global_eid, &ret_status, set_id,
+            encrypted_test_data.data(), encrypted_test_data.size(),
+            encrypted_results.data(), encrypted_results.size(), &result_count) != SGX_SUCCESS ||
+        ret_status != SGX_SUCCESS) {
+        results.errors++;
+        return;
+    }
+
+    std::vector<uint8_t> result(PAYLOAD_RESULT_SIZE(result_count) - RESULT_HEADER_SIZE);
+    if (!decrypt_result(key_data, ctx, encrypted_results.data(), result.data(), result.size())) {
+        results.errors += result_count;
+        return;
+    }
+    tally_bitmap(result.data(), result_count, results);
+}
+
+// Has the enclave decrypt the test file back into host memory
+static bool decrypt_test_values(const std::vector<uint8_t>& encrypted_test_data,
+                                std::vector<int>& values) {
+    sgx_status_t decrypt_ret_status;
+
+    if (is_query_file(encrypted_test_data.data(), encrypted_test_data.size())) {
+        const QueryFileHeader* header =
+            reinterpret_cast<const QueryFileHeader*>(encrypted_test_data.data());
+        values.resize(header->count);
+        return (ecall_decrypt_query_file(global_eid, &decrypt_ret_status,
+                encrypted_test_data.data(), encrypted_test_data.size(),
+                values.data(), values.size()) == SGX_SUCCESS &&
+                decrypt_ret_status == SGX_SUCCESS);
+    }
+
+    std::vector<uint8_t> decrypted_test_data(encrypted_test_data.size());
+    if (ecall_decrypt_test_data(global_eid, &decrypt_ret_status,
+        encrypted_test_data.data(), encrypted_test_data.size(),
+        decrypted_test_data.data(), decrypted_test_data.size()) != SGX_SUCCESS) {
+        return false;
+    }
+
+    const TestData* test_data = reinterpret_cast<const TestData*>(decrypted_test_data.data());
+    if (test_data->version != CURRENT_VERSION || test_data->count == 0 ||
+        test_data->count > MAX_VALUES) {
+        return false;
+    }
+
+    values.assign(test_data->values, test_data->values + test_data->count);
+    return true;
+}
+
+// Loads secret_file as set set_id and runs test_file against it
+TestResults run_test_iteration(uint32_t set_id, const std::string& secret_file,
+                               const std::string& test_file, const RunConfig& config) {
+    TestResults results = {0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0};
+    auto total_start = std::chrono::high_resolution_clock::now();
+
+    sgx_status_t timing_reset_status;
+    if (ecall_reset_timing(global_eid, &timing_reset_status) != SGX_SUCCESS) {
+        return results;
+    }
+
+    if (!load_secret_set(set_id, secret_file)) {
+        return results;
+    }
+    log_engine_report(set_id, "");
+
+    std::vector<uint8_t> encrypted_test_data;
+    if (!load_sealed_data(test_file, encrypted_test_data, true)) {
+        return results;
+    }
+
+    EVP_CIPHER_CTX *ctx = EVP_CIPHER_CTX_new();
+    if (!ctx) {
+        return results;
+    }
+
+    std::vector<uint8_t> key_data;
+    if (!read_key_file(key_data)) {
+        EVP_CIPHER_CTX_free(ctx);
+        return results;
+    }
+
+    // Only 32-bit query files decrypt into host values; wider ones always
+    // run pipelined, as does a threshold, which only means something over
+    // the whole file
+    std::vector<int> test_values;
+    if (config.payloads) {
+        check_payloads_pipelined(set_id, encrypted_test_data, key_data, ctx, results);
+    } else if (config.pipeline || config.result_mode == RESULT_MODE_THRESHOLD ||
+        !is_int32_query_file(encrypted_test_data)) {
+        check_values_pipelined(set_id, encrypted_test_data, key_data, ctx, config.result_mode,
+                               results);
+    } else if (decrypt_test_values(encrypted_test_data, test_values)) {
+        if (config.threads > 1) {
+            check_values_parallel(set_id, test_values, key_data, config.batch_size,
+                                  config.result_mode, config.threads, results);
+        } else {
+            check_values_range(set_id, test_values, 0, (uint32_t)test_values.size(), key_data, ctx,
+                               config.batch_size, config.result_mode, results);
+        }
+    }
 
     EVP_CIPHER_CTX_free(ctx);
 
@@ -237,23 +827,33 @@ TestResults run_test_iteration(const std::string& secret_file, const std::string
     uint64_t enclave_processing_time = 0;
     uint64_t enclave_total_time = 0;
     uint64_t enclave_decryption_time = 0;
+    uint64_t enclave_index_build_time = 0;
+    uint64_t enclave_index_memory = 0;
 
     sgx_status_t timing_status;
-    if (ecall_get_timing_info(global_eid, &timing_status,
+    if (ecall_get_timing_info(global_eid, &timing_status, set_id,
                              &enclave_encryption_time,
                              &enclave_processing_time,
                              &enclave_total_time,
-                             &enclave_decryption_time) == SGX_SUCCESS) {
+                             &enclave_decryption_time,
+                             &enclave_index_build_time,
+                             &enclave_index_memory) == SGX_SUCCESS) {
         results.encryption_time_us = enclave_encryption_time;
         results.processing_time_us = enclave_processing_time;
         results.decryption_time_us = enclave_decryption_time;
+        results.index_build_time_us = enclave_index_build_time;
+        results.index_memory_bytes = enclave_index_memory;
     }
 
     auto total_end = std::chrono::high_resolution_clock::now();
     results.total_time_us = std::chrono::duration_cast<std::chrono::microseconds>(
         total_end - total_start).count();
-    results.overhead_time_us = results.total_time_us - 
-        (results.processing_time_us + results.encryption_time_us + results.decryption_time_us);
+    // With --threads the enclave times add up across threads and can exceed
+    // the wall-clock total
+    uint64_t enclave_time_us = results.processing_time_us + results.encryption_time_us +
+                               results.decryption_time_us;
+    results.overhead_time_us = results.total_time_us > enclave_time_us ?
+                               results.total_time_us - enclave_time_us : 0;
 
     return results;
 }
@@ -273,27 +873,403 @@ uint64_t ocall_get_current_time(uint64_t* time) {
     return 0;
 }
 
+// Backs the pages of the paged engine, which hold only ciphertext
+void* ocall_alloc_untrusted(size_t size) {
+    return malloc(size);
+}
+
+void ocall_free_untrusted(void* ptr) {
+    free(ptr);
+}
+
+// Sends each test file to a running service instead of loading an enclave
+static int run_service_client(const std::string& socket_path, uint32_t set_id, int num_iterations) {
+    std::vector<uint8_t> key_data;
+    if (!read_key_file(key_data)) {
+        fprintf(stderr, "Failed to read encryption key\n");
+        return 1;
+    }
+
+    printf("Test,Matches,NonMatches,Errors,TotalTime_us,ProcessingTime_us,"
+           "EncryptionTime_us,DecryptionTime_us,OverheadTime_us\n");
+
+    for (int i = 1; i <= num_iterations; i++) {
+        std::string test_file = "tools/sealed_data/test_numbers" + std::to_string(i) + ".dat";
+
+        TestResults results = {0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0};
+        if (!query_service(socket_path, set_id, test_file, key_data, results)) {
+            fprintf(stderr, "Query to service at %s failed\n", socket_path.c_str());
+            return 1;
+        }
+
+        printf("%d,%d,%d,%d,%lu,%lu,%lu,%lu,%lu\n",
+            i, results.matches, results.non_matches, results.errors,
+            results.total_time_us, results.processing_time_us,
+            results.encryption_time_us, results.decryption_time_us,
+            results.overhead_time_us);
+    }
+
+    return 0;
+}
+
+// Maps command line names onto the ids in shared_types.h
+struct NamedValue {
+    const char* name;
+    uint32_t value;
+};
+
+static const NamedValue engine_names[] = {
+    {"linear",     LOOKUP_ENGINE_LINEAR},
+    {"eytzinger",  LOOKUP_ENGINE_EYTZINGER},
+    {"hash",       LOOKUP_ENGINE_HASH},
+    {"paged",      LOOKUP_ENGINE_PAGED},
+    {"oblivious",  LOOKUP_ENGINE_OBLIVIOUS},
+    {"elias-fano", LOOKUP_ENGINE_ELIAS_FANO},
+    {"auto",       LOOKUP_ENGINE_AUTO},
+};
+
+static const NamedValue batch_mode_names[] = {
+    {"lookup",      BATCH_MODE_LOOKUP},
+    {"merge",       BATCH_MODE_MERGE},
+    {"interleaved", BATCH_MODE_INTERLEAVED},
+};
+
+static const NamedValue result_mode_names[] = {
+    {"bitmap",      RESULT_MODE_BITMAP},
+    {"cardinality", RESULT_MODE_CARDINALITY},
+    {"threshold",   RESULT_MODE_THRESHOLD},
+};
+
+template <size_t N>
+static bool parse_named_value(const NamedValue (&table)[N], const char* name, uint32_t* value) {
+    for (const NamedValue& entry : table) {
+        if (strcmp(name, entry.name) == 0) {
+            *value = entry.value;
+            return true;
+        }
+    }
+    return false;
+}
+
+template <size_t N>
+static void print_named_values(const NamedValue (&table)[N]) {
+    for (const NamedValue& entry : table) {
+        fprintf(stderr, " %s", entry.name);
+    }
+}
+
+template <size_t N>
+static const char* named_value_name(const NamedValue (&table)[N], uint32_t value) {
+    for (const NamedValue& entry : table) {
+        if (entry.value == value) {
+            return entry.name;
+        }
+    }
+    return "unknown";
+}
+
+// Logs the engine the auto engine chose for set_id and the calibration it
+// chose by; a set whose engine was named on the command line logs nothing
+void log_engine_report(uint32_t set_id, const char* prefix) {
+    EngineReport report;
+    sgx_status_t ret_status;
+    if (ecall_get_engine_report(global_eid, &ret_status, set_id, (uint8_t*)&report,
+                                sizeof(report)) != SGX_SUCCESS ||
+        ret_status != SGX_SUCCESS || report.candidate_count == 0) {
+        return;
+    }
+
+    fprintf(stderr, "%sauto engine chose %s for set %u\n", prefix,
+            named_value_name(engine_names, report.engine), set_id);
+    for (uint32_t i = 0; i < report.candidate_count && i < LOOKUP_ENGINE_COUNT; i++) {
+        const EngineCalibration& candidate = report.candidates[i];
+        fprintf(stderr, "%s  %-10s %10lu bytes, built in %lu us, %lu ns per lookup%s\n", prefix,
+                named_value_name(engine_names, candidate.engine), candidate.memory_bytes,
+                candidate.build_time_us, candidate.lookup_ns,
+                candidate.fits_budget ? "" : ", over the memory budget");
+    }
+}
+
+static void print_usage(const char* program) {
+    fprintf(stderr, "Usage: %s [--batch-size N] [--engine NAME] [--batch-mode NAME] "
+                    "[--result-mode NAME [--threshold N]] [--pipeline] [--payloads] "
+                    "[--threads N] [--switchless-workers N] <number_of_tests>\n", program);
+    fprintf(stderr, "       %s --serve SOCKET [--secret FILE]... [--snapshot FILE] [--engine NAME] "
+                    "[--batch-mode NAME] [--result-mode NAME [--threshold N]] [--memory-budget MB] "
+                    "[--switchless-workers N]\n", program);
+    fprintf(stderr, "       %s --connect SOCKET [--set N] <number_of_tests>\n", program);
+    fprintf(stderr, "       %s --connect SOCKET [--set N] --insert FILE | --delete FILE\n", program);
+    fprintf(stderr, "  --batch-size N         Test values checked per enclave call "
+                    "(default %d, 0 = one call per value)\n", DEFAULT_BATCH_SIZE);
+    fprintf(stderr, "  --engine NAME          Enclave lookup engine:");
+    print_named_values(engine_names);
+    fprintf(stderr, " (default linear); auto calibrates each set's candidates as it loads "
+                    "and keeps the fastest that fits the memory budget\n");
+    fprintf(stderr, "  --batch-mode NAME      How a batch is checked:");
+    print_named_values(batch_mode_names);
+    fprintf(stderr, " (default lookup)\n");
+    fprintf(stderr, "  --result-mode NAME     What the enclave returns per call:");
+    print_named_values(result_mode_names);
+    fprintf(stderr, " (default bitmap); cardinality and threshold return one "
+                    "encrypted count or boolean instead of a bit per value\n");
+    fprintf(stderr, "  --threshold N          Matches the threshold result mode asks for; "
+                    "Matches is then 1 if reached, else 0, and the test file is checked in one "
+                    "enclave call (default 0)\n");
+    fprintf(stderr, "  --pipeline             Decrypt, check and encrypt the whole test file "
+                    "in one enclave call\n");
+    fprintf(stderr, "  --payloads             Join the test file against a keyed secret set "
+                    "(value_sealer seal-keyed) in one enclave call, returning each value's payload\n");
+    fprintf(stderr, "  --threads N            Split the test values across N host threads, "
+                    "each entering the enclave on its own TCS (1-%d, default 1)\n",
+            MAX_QUERY_THREADS);
+    fprintf(stderr, "  --switchless-workers N Run hot ecalls/ocalls switchless on N worker "
+                    "threads per side (0-%d, default 0 = off)\n", MAX_SWITCHLESS_WORKERS);
+    fprintf(stderr, "  --memory-budget MB     Enclave memory for resident secret sets; the least "
+                    "recently used are evicted beyond it (default 0 = unlimited)\n");
+    fprintf(stderr, "  --serve SOCKET         Keep the enclave and secret set loaded and answer "
+                    "encrypted test files on a Unix socket\n");
+    fprintf(stderr, "  --secret FILE          Secret set served by --serve; repeat for more sets, "
+                    "numbered from 0 (default %s). A set split into sorted shards FILE.0, "
+                    "FILE.1, ... (each from value_sealer seal) is merged as it loads\n",
+            DEFAULT_SERVICE_SECRET_FILE);
+    fprintf(stderr, "  --snapshot FILE        With --serve, restore set N's built index from the sealed "
+                    "snapshot FILE.N when it is newer than the secret set, else rebuild and save it\n");
+    fprintf(stderr, "  --connect SOCKET       Send the test files to a running --serve instance\n");
+    fprintf(stderr, "  --set N                With --connect, the served set to query or update "
+                    "(default 0)\n");
+    fprintf(stderr, "  --insert FILE          With --connect, add the values in FILE (a value_sealer "
+                    "seal-tests file) to the service's secret set\n");
+    fprintf(stderr, "  --delete FILE          With --connect, remove the values in FILE from the "
+                    "service's secret set\n");
+}
+
 int main(int argc, char* argv[]) {
     std::atexit(cleanup_resources);
 
-    if (argc != 2) {
-        fprintf(stderr, "Usage: %s <number_of_tests>\n", argv[0]);
+    RunConfig config = {DEFAULT_BATCH_SIZE, false, 1, RESULT_MODE_BITMAP, false};
+    std::string serve_path;
+    std::string connect_path;
+    std::vector<std::string> secret_files;
+    std::string snapshot_file;
+    uint32_t set_id = 0;
+    uint64_t memory_budget_mb = 0;
+    std::string update_file;
+    uint32_t update_type = SERVICE_REQUEST_QUERY;
+    uint32_t switchless_workers = 0;
+    uint32_t engine = LOOKUP_ENGINE_LINEAR;
+    uint32_t batch_mode = BATCH_MODE_LOOKUP;
+    uint32_t result_threshold = 0;
+
+    static const struct option long_options[] = {
+        {"batch-size", required_argument, NULL, 'b'},
+        {"engine",     required_argument, NULL, 'e'},
+        {"batch-mode", required_argument, NULL, 'm'},
+        {"result-mode", required_argument, NULL, 'r'},
+        {"threshold",  required_argument, NULL, 'T'},
+        {"pipeline",   no_argument,       NULL, 'p'},
+        {"payloads",   no_argument,       NULL, 'P'},
+        {"serve",      required_argument, NULL, 's'},
+        {"secret",     required_argument, NULL, 'S'},
+        {"snapshot",   required_argument, NULL, 'n'},
+        {"connect",    required_argument, NULL, 'c'},
+        {"set",        required_argument, NULL, 'I'},
+        {"memory-budget", required_argument, NULL, 'M'},
+        {"insert",     required_argument, NULL, 'i'},
+        {"delete",     required_argument, NULL, 'd'},
+        {"threads",    required_argument, NULL, 't'},
+        {"switchless-workers", required_argument, NULL, 'w'},
+        {"help",       no_argument,       NULL, 'h'},
+        {NULL, 0, NULL, 0}
+    };
+
+    int opt;
+    while ((opt = getopt_long(argc, argv, "b:e:m:r:T:pPs:S:n:c:I:M:i:d:t:w:h", long_options, NULL)) != -1) {
+        switch (opt) {
+            case 'b':
+                try {
+                    int value = std::stoi(optarg);
+                    if (value < 0 || value > MAX_VALUES) {
+                        throw std::invalid_argument("Batch size out of range");
+                    }
+                    config.batch_size = (size_t)value;
+                }
+                catch (const std::exception&) {
+                    fprintf(stderr, "Invalid batch size specified\n");
+                    return 1;
+                }
+                break;
+            case 'e':
+                if (!parse_named_value(engine_names, optarg, &engine)) {
+                    fprintf(stderr, "Unknown lookup engine: %s\n", optarg);
+                    return 1;
+                }
+                break;
+            case 'm':
+                if (!parse_named_value(batch_mode_names, optarg, &batch_mode)) {
+                    fprintf(stderr, "Unknown batch mode: %s\n", optarg);
+                    return 1;
+                }
+                break;
+            case 'r':
+                if (!parse_named_value(result_mode_names, optarg, &config.result_mode)) {
+                    fprintf(stderr, "Unknown result mode: %s\n", optarg);
+                    return 1;
+                }
+                break;
+            case 'T':
+                try {
+                    int value = std::stoi(optarg);
+                    if (value < 0 || value > MAX_VALUES) {
+                        throw std::invalid_argument("Threshold out of range");
+                    }
+                    result_threshold = (uint32_t)value;
+                }
+                catch (const std::exception&) {
+                    fprintf(stderr, "Invalid threshold specified\n");
+                    return 1;
+                }
+                break;
+            case 'p':
+                config.pipeline = true;
+                break;
+            case 'P':
+                config.payloads = true;
+                break;
+            case 's':
+                serve_path = optarg;
+                break;
+            case 'S':
+                secret_files.push_back(optarg);
+                break;
+            case 'n':
+                snapshot_file = optarg;
+                break;
+            case 'c':
+                connect_path = optarg;
+                break;
+            case 'I':
+                try {
+                    unsigned long value = std::stoul(optarg);
+                    if (value > UINT32_MAX) {
+                        throw std::invalid_argument("Set id out of range");
+                    }
+                    set_id = (uint32_t)value;
+                }
+                catch (const std::exception&) {
+                    fprintf(stderr, "Invalid set id specified\n");
+                    return 1;
+                }
+                break;
+            case 'M':
+                try {
+                    memory_budget_mb = std::stoull(optarg);
+                }
+                catch (const std::exception&) {
+                    fprintf(stderr, "Invalid memory budget specified\n");
+                    return 1;
+                }
+                break;
+            case 'i':
+            case 'd':
+                if (!update_file.empty()) {
+                    fprintf(stderr, "Only one of --insert and --delete may be given\n");
+                    return 1;
+                }
+                update_file = optarg;
+                update_type = (opt == 'i') ? SERVICE_REQUEST_INSERT : SERVICE_REQUEST_DELETE;
+                break;
+            case 't':
+                try {
+                    int value = std::stoi(optarg);
+                    if (value < 1 || value > MAX_QUERY_THREADS) {
+                        throw std::invalid_argument("Thread count out of range");
+                    }
+                    config.threads = (uint32_t)value;
+                }
+                catch (const std::exception&) {
+                    fprintf(stderr, "Invalid thread count specified\n");
+                    return 1;
+                }
+                break;
+            case 'w':
+                try {
+                    int value = std::stoi(optarg);
+                    if (value < 0 || value > MAX_SWITCHLESS_WORKERS) {
+                        throw std::invalid_argument("Worker count out of range");
+                    }
+                    switchless_workers = (uint32_t)value;
+                }
+                catch (const std::exception&) {
+                    fprintf(stderr, "Invalid switchless worker count specified\n");
+                    return 1;
+                }
+                break;
+            case 'h':
+                print_usage(argv[0]);
+                return 0;
+            default:
+                print_usage(argv[0]);
+                return 1;
+        }
+    }
+
+    bool serve = !serve_path.empty();
+    bool update = !update_file.empty();
+    if ((serve && !connect_path.empty()) || (!serve && !snapshot_file.empty()) ||
+        (update && connect_path.empty()) || argc - optind != ((serve || update) ? 0 : 1)) {
+        print_usage(argv[0]);
         return 1;
     }
 
-    int num_iterations;
-    try {
-        num_iterations = std::stoi(argv[1]);
-        if (num_iterations <= 0) {
-            throw std::invalid_argument("Number of tests must be positive");
+    if (update) {
+        uint32_t delta_size = 0;
+        if (!update_service(connect_path, set_id, update_type, update_file, &delta_size)) {
+            fprintf(stderr, "Update through service at %s failed\n", connect_path.c_str());
+            return 1;
         }
+        printf("Updated secret set, %u pending updates\n", delta_size);
+        return 0;
     }
-    catch (const std::exception&) {
-        fprintf(stderr, "Invalid number of tests specified\n");
+
+    if (config.payloads && (serve || !connect_path.empty())) {
+        fprintf(stderr, "--payloads cannot be combined with --serve or --connect\n");
+        return 1;
+    }
+
+    // Only the per-value and batched paths are split across threads
+    if (config.threads > 1 && (serve || !connect_path.empty() || config.pipeline ||
+                               config.payloads || config.result_mode == RESULT_MODE_THRESHOLD)) {
+        fprintf(stderr, "--threads cannot be combined with --serve, --connect, --pipeline, "
+                        "--payloads or the threshold result mode\n");
+        return 1;
+    }
+
+    // Trusted switchless workers occupy a TCS each for the enclave's lifetime
+    if (config.threads + switchless_workers > ENCLAVE_TCS_NUM) {
+        fprintf(stderr, "--threads plus --switchless-workers must not exceed %d\n",
+                ENCLAVE_TCS_NUM);
         return 1;
     }
 
-    if (initialize_enclave() < 0) {
+    int num_iterations = 0;
+    if (!serve) {
+        try {
+            num_iterations = std::stoi(argv[optind]);
+            if (num_iterations <= 0) {
+                throw std::invalid_argument("Number of tests must be positive");
+            }
+        }
+        catch (const std::exception&) {
+            fprintf(stderr, "Invalid number of tests specified\n");
+            return 1;
+        }
+    }
+
+    if (!connect_path.empty()) {
+        return run_service_client(connect_path, set_id, num_iterations);
+    }
+
+    if (initialize_enclave(switchless_workers) < 0) {
         fprintf(stderr, "Enclave initialization failed\n");
         return 1;
     }
@@ -303,20 +1279,62 @@ int main(int argc, char* argv[]) {
         return 1;
     }
 
+    sgx_status_t engine_ret_status;
+    if (ecall_set_lookup_engine(global_eid, &engine_ret_status, engine) != SGX_SUCCESS ||
+        engine_ret_status != SGX_SUCCESS) {
+        fprintf(stderr, "Failed to select lookup engine\n");
+        return 1;
+    }
+
+    sgx_status_t mode_ret_status;
+    if (ecall_set_batch_mode(global_eid, &mode_ret_status, batch_mode) != SGX_SUCCESS ||
+        mode_ret_status != SGX_SUCCESS) {
+        fprintf(stderr, "Failed to select batch mode\n");
+        return 1;
+    }
+
+    sgx_status_t result_ret_status;
+    if (ecall_set_result_mode(global_eid, &result_ret_status, config.result_mode,
+                              result_threshold) != SGX_SUCCESS ||
+        result_ret_status != SGX_SUCCESS) {
+        fprintf(stderr, "Failed to select result mode\n");
+        return 1;
+    }
+
+    sgx_status_t budget_ret_status;
+    if (ecall_set_memory_budget(global_eid, &budget_ret_status, memory_budget_mb << 20) != SGX_SUCCESS ||
+        budget_ret_status != SGX_SUCCESS) {
+        fprintf(stderr, "Failed to set memory budget\n");
+        return 1;
+    }
+
+    if (serve) {
+        if (secret_files.empty()) {
+            secret_files.push_back(DEFAULT_SERVICE_SECRET_FILE);
+        }
+        return run_service(serve_path, secret_files, snapshot_file, config.result_mode) ? 0 : 1;
+    }
+
     printf("Test,Matches,NonMatches,Errors,TotalTime_us,ProcessingTime_us,"
-           "EncryptionTime_us,DecryptionTime_us,OverheadTime_us,PageFaults\n");
+           "EncryptionTime_us,DecryptionTime_us,OverheadTime_us,PageFaults,"
+           "IndexBuildTime_us,IndexMemory_bytes\n");
 
     for (int i = 1; i <= num_iterations; i++) {
         std::string secret_file = "tools/sealed_data/secret_numbers" + std::to_string(i) + ".dat";
         std::string test_file = "tools/sealed_data/test_numbers" + std::to_string(i) + ".dat";
 
-        TestResults results = run_test_iteration(secret_file, test_file);
+        // Each test loads its set under its own id and releases it once done,
+        // so no earlier set stays resident to skew the timings and page faults
+        TestResults results = run_test_iteration((uint32_t)i, secret_file, test_file, config);
+        sgx_status_t release_ret_status;
+        ecall_release_secret_set(global_eid, &release_ret_status, (uint32_t)i);
 
-        printf("%d,%d,%d,%d,%lu,%lu,%lu,%lu,%lu,%lu\n",
+        printf("%d,%d,%d,%d,%lu,%lu,%lu,%lu,%lu,%lu,%lu,%lu\n",
             i, results.matches, results.non_matches, results.errors,
             results.total_time_us, results.processing_time_us,
             results.encryption_time_us, results.decryption_time_us,
-            results.overhead_time_us, results.page_faults);
+            results.overhead_time_us, results.page_faults,
+            results.index_build_time_us, results.index_memory_bytes);
     }
 
     return 0;
@@ -5,13 +5,43 @@
 #include <stdio.h>
 #include <string>
 #include <vector>
+#include <openssl/evp.h>
 #include "sgx_urts.h"
 
 #define ENCLAVE_FILE "sgx_equality_test.signed.so"
 
+#define AES_KEY_SIZE 16
+#define AES_BLOCK_SIZE 16
+#define MAX_FILE_SIZE (256 * 1024 * 1024)
+
+extern sgx_enclave_id_t global_eid;
+
+struct TestResults {
+    int matches;
+    int non_matches;
+    int errors;
+    uint64_t total_time_us;
+    uint64_t processing_time_us;
+    uint64_t encryption_time_us;
+    uint64_t decryption_time_us;  
+    uint64_t overhead_time_us;
+    uint64_t page_faults;
+    uint64_t index_build_time_us;
+    uint64_t index_memory_bytes;
+};
+
 // Function declarations
 bool load_sealed_data(const std::string& filename, std::vector<uint8_t>& sealed_data, bool is_test_data = false);
-bool validate_sealed_data(const std::vector<uint8_t>& sealed_data, const char* type);
 bool initialize_encryption_key();
+bool is_query_file(const uint8_t* data, size_t size);
+bool read_key_file(std::vector<uint8_t>& key_data);
+bool secret_set_mtime(const std::string& secret_file, time_t* mtime);
+bool load_secret_set(uint32_t set_id, const std::string& secret_file);
+bool save_index_snapshot(uint32_t set_id, const std::string& snapshot_file);
+bool load_index_snapshot(uint32_t set_id, const std::string& snapshot_file);
+void log_engine_report(uint32_t set_id, const char* prefix);
+bool decrypt_and_tally_results(const std::vector<uint8_t>& key_data, EVP_CIPHER_CTX* ctx,
+                               const uint8_t* encrypted_results, size_t count, uint32_t result_mode,
+                               uint8_t* bitmap, TestResults& results);
 
 #endif
@@ -0,0 +1,633 @@
+// Service.cpp
+#include "Service.h"
+#include "Enclave_u.h"
+#include "shared_types.h"
+#include <chrono>
+#include <condition_variable>
+#include <fstream>
+#include <mutex>
+#include <thread>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+static volatile sig_atomic_t g_stop_service = 0;
+
+// A set the service answers for, loaded under its position in g_service_sets
+struct ServiceSet {
+    std::string secret_file;
+    std::string snapshot_file;   // Empty without --snapshot
+    std::string delta_log_file;  // Empty without --snapshot
+    uint32_t delta_size;         // Pending updates in the enclave
+    bool compact_queued;         // Waiting for the compaction thread
+    bool log_stale;              // Delta log no longer replays onto the snapshot on disk
+};
+
+static std::vector<ServiceSet> g_service_sets;
+static uint32_t g_service_result_mode = RESULT_MODE_BITMAP;
+
+// Queries run on the request thread while the compaction thread folds
+// pending updates into a new version of their set, which the enclave allows.
+// Everything else that changes a set in the enclave, or a set's files and
+// ServiceSet, holds g_set_writes: loads, updates, replays and compactions.
+static std::mutex g_set_writes;
+static std::condition_variable g_compaction_wanted;
+static bool g_stop_compacting = false;  // Under g_set_writes
+
+static void handle_stop_signal(int) {
+    g_stop_service = 1;
+}
+
+static bool read_fully(int fd, void* buffer, size_t size) {
+    uint8_t* dst = static_cast<uint8_t*>(buffer);
+    while (size > 0) {
+        ssize_t n = read(fd, dst, size);
+        if (n < 0 && errno == EINTR && !g_stop_service) {
+            continue;
+        }
+        if (n <= 0) {
+            return false;
+        }
+        dst += n;
+        size -= n;
+    }
+    return true;
+}
+
+static bool write_fully(int fd, const void* buffer, size_t size) {
+    const uint8_t* src = static_cast<const uint8_t*>(buffer);
+    while (size > 0) {
+        ssize_t n = write(fd, src, size);
+        if (n < 0 && errno == EINTR && !g_stop_service) {
+            continue;
+        }
+        if (n <= 0) {
+            return false;
+        }
+        src += n;
+        size -= n;
+    }
+    return true;
+}
+
+static bool make_socket_address(const std::string& socket_path, sockaddr_un& address) {
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (socket_path.size() >= sizeof(address.sun_path)) {
+        return false;
+    }
+    memcpy(address.sun_path, socket_path.c_str(), socket_path.size() + 1);
+    return true;
+}
+
+// Appends one sealed update record to a set's delta log and syncs it to disk
+static bool append_delta_record(const ServiceSet& set, const uint8_t* record, uint32_t record_size) {
+    if (set.delta_log_file.empty()) {
+        return true;
+    }
+
+    int fd = open(set.delta_log_file.c_str(), O_WRONLY | O_APPEND | O_CREAT, 0600);
+    if (fd < 0) {
+        return false;
+    }
+
+    bool ok = write_fully(fd, &record_size, sizeof(record_size)) &&
+              write_fully(fd, record, record_size) &&
+              fdatasync(fd) == 0;
+    close(fd);
+    return ok;
+}
+
+// Saves a set's snapshot and empties its delta log, marking the log stale
+// unless both succeed. The snapshot is renamed into place before the log is
+// emptied, so a crash in between leaves the new snapshot with the old log,
+// whose records replay rejects; their updates are already in the snapshot.
+static bool save_service_snapshot(uint32_t set_id) {
+    ServiceSet& set = g_service_sets[set_id];
+    set.log_stale = !save_index_snapshot(set_id, set.snapshot_file) ||
+                    (truncate(set.delta_log_file.c_str(), 0) != 0 && errno != ENOENT);
+    return !set.log_stale;
+}
+
+// Folds a set's pending updates into it and, with a snapshot, saves it and
+// empties the delta log. Compacting starts a new delta log generation, so if
+// the snapshot is not saved the log on disk goes stale.
+static bool compact_service_set(uint32_t set_id) {
+    ServiceSet& set = g_service_sets[set_id];
+    sgx_status_t ret_status;
+    if (ecall_compact_secret_set(global_eid, &ret_status, set_id) != SGX_SUCCESS ||
+        ret_status != SGX_SUCCESS) {
+        return false;
+    }
+    set.delta_size = 0;
+
+    if (set.snapshot_file.empty()) {
+        return true;
+    }
+    return save_service_snapshot(set_id);
+}
+
+// Replays a set's delta log onto the set just restored from its snapshot.
+// records receives the number applied; returns false if the log does not
+// apply in full, which a torn last record or a log left from an older
+// snapshot cause.
+static bool replay_delta_log(uint32_t set_id, uint32_t* records) {
+    ServiceSet& set = g_service_sets[set_id];
+    *records = 0;
+    std::ifstream log(set.delta_log_file, std::ios::binary);
+    if (!log) {
+        return true;
+    }
+
+    std::vector<uint8_t> record;
+    uint32_t record_size;
+    while (log.read(reinterpret_cast<char*>(&record_size), sizeof(record_size))) {
+        if (record_size > DELTA_RECORD_SIZE_MAX(MAX_VALUES, KEY_TYPE_DIGEST128)) {
+            return false;
+        }
+
+        record.resize(record_size);
+        if (!log.read(reinterpret_cast<char*>(record.data()), record.size())) {
+            return false;
+        }
+
+        sgx_status_t ret_status;
+        if (ecall_replay_delta_record(global_eid, &ret_status, set_id, record.data(), record.size(),
+                                      &set.delta_size) != SGX_SUCCESS ||
+            ret_status != SGX_SUCCESS) {
+            return false;
+        }
+        (*records)++;
+    }
+    return log.eof() && log.gcount() == 0;
+}
+
+// Loads a served set into the enclave, at startup or after eviction. Restores
+// it from its snapshot when that is at least as new as the secret file and
+// replays the delta log; otherwise loads the secret file and refreshes the
+// snapshot.
+static bool load_service_set(uint32_t set_id) {
+    ServiceSet& set = g_service_sets[set_id];
+    set.delta_size = 0;
+
+    time_t secret_mtime;
+    struct stat snapshot_stat;
+    if (!set.snapshot_file.empty() &&
+        secret_set_mtime(set.secret_file, &secret_mtime) &&
+        stat(set.snapshot_file.c_str(), &snapshot_stat) == 0 &&
+        snapshot_stat.st_mtime >= secret_mtime) {
+        if (load_index_snapshot(set_id, set.snapshot_file)) {
+            printf("Service: restored index snapshot %s\n", set.snapshot_file.c_str());
+            set.log_stale = false;
+
+            // A log that does not apply in full is dropped by compacting what did
+            uint32_t records = 0;
+            bool replayed = replay_delta_log(set_id, &records);
+            if (!replayed) {
+                fprintf(stderr, "Service: delta log %s stops applying after %u records\n",
+                        set.delta_log_file.c_str(), records);
+            }
+            if (records > 0) {
+                printf("Service: replayed %u delta records\n", records);
+            }
+            if ((records > 0 || !replayed) && !compact_service_set(set_id)) {
+                fprintf(stderr, "Service: failed to compact replayed updates\n");
+                set.log_stale = set.log_stale || !replayed;  // Appends would follow a bad record
+            }
+            return true;
+        }
+        fprintf(stderr, "Service: snapshot %s unusable, rebuilding\n", set.snapshot_file.c_str());
+    }
+
+    if (!load_secret_set(set_id, set.secret_file)) {
+        fprintf(stderr, "Service: failed to load secret set %s\n", set.secret_file.c_str());
+        return false;
+    }
+    log_engine_report(set_id, "Service: ");
+
+    // Any existing log belongs to an older set
+    set.log_stale = false;
+    if (!set.snapshot_file.empty() && !save_service_snapshot(set_id)) {
+        fprintf(stderr, "Service: failed to write snapshot %s\n", set.snapshot_file.c_str());
+    }
+    return true;
+}
+
+// Runs call, which returns the combined status of one ecall on set_id, and
+// once more after reloading the set if the enclave had evicted it. The
+// caller holds g_set_writes.
+template <typename Call>
+static sgx_status_t call_on_set(uint32_t set_id, Call call) {
+    sgx_status_t status = call();
+    if (status == SGX_ERROR_INVALID_STATE && load_service_set(set_id)) {
+        status = call();
+    }
+    return status;
+}
+
+// Applies an insert or delete batch and logs its sealed record before
+// answering, so an acknowledged update survives a restart
+static void handle_update(uint32_t set_id, uint32_t type, const std::vector<uint8_t>& payload,
+                          ServiceResponseHeader& response) {
+    if (!is_query_file(payload.data(), payload.size())) {
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(g_set_writes);
+    ServiceSet& set = g_service_sets[set_id];
+    QueryFileHeader header;
+    memcpy(&header, payload.data(), sizeof(header));
+    std::vector<uint8_t> record(DELTA_RECORD_SIZE_MAX(header.count, header.key_type));
+    uint32_t record_used = 0;
+    uint32_t delta_size = 0;
+
+    uint32_t op = (type == SERVICE_REQUEST_INSERT) ? UPDATE_INSERT : UPDATE_DELETE;
+    sgx_status_t status = call_on_set(set_id, [&]() {
+        sgx_status_t ret_status;
+        sgx_status_t call_status = ecall_update_secret_set(global_eid, &ret_status, set_id, op,
+            payload.data(), payload.size(), record.data(), record.size(), &record_used, &delta_size);
+        return (call_status != SGX_SUCCESS) ? call_status : ret_status;
+    });
+    if (status != SGX_SUCCESS) {
+        response.status = status;
+        return;
+    }
+    set.delta_size = delta_size;
+
+    // The update is already live. It is not logged to a stale log or if
+    // logging fails; a snapshot of the compacted set makes it durable instead,
+    // and until one is saved every update is answered as not durable.
+    response.status = SGX_SUCCESS;
+    bool logged = !set.log_stale && append_delta_record(set, record.data(), record_used);
+    if (!logged && !compact_service_set(set_id)) {
+        fprintf(stderr, "Service: update applied but not persisted to %s\n",
+                set.delta_log_file.c_str());
+        response.status = SERVICE_STATUS_NOT_DURABLE;
+    }
+
+    response.result_count = header.count;
+    response.delta_size = set.delta_size;
+
+    // Compaction rebuilds the whole set, so it is left to the compaction
+    // thread, which starts once this update has let go of g_set_writes
+    if (set.delta_size >= SERVICE_COMPACT_THRESHOLD && !set.compact_queued) {
+        set.compact_queued = true;
+        g_compaction_wanted.notify_one();
+    }
+}
+
+// Compacts the sets handle_update queues until run_service stops it. Updates
+// wait while it works; queries do not.
+static void run_compactions() {
+    std::unique_lock<std::mutex> lock(g_set_writes);
+    while (!g_stop_compacting) {
+        for (uint32_t set_id = 0; set_id < g_service_sets.size(); set_id++) {
+            ServiceSet& set = g_service_sets[set_id];
+            if (!set.compact_queued) {
+                continue;
+            }
+            set.compact_queued = false;
+            uint32_t pending = set.delta_size;
+            if (pending >= SERVICE_COMPACT_THRESHOLD && !compact_service_set(set_id)) {
+                fprintf(stderr, "Service: failed to compact %u pending updates\n", pending);
+            }
+        }
+        g_compaction_wanted.wait(lock);
+    }
+}
+
+// Runs one query through the enclave pipeline; results receives the
+// encrypted bitmap on success
+static void handle_query(uint32_t set_id, const std::vector<uint8_t>& payload,
+                         ServiceResponseHeader& response, std::vector<uint8_t>& results) {
+    if (payload.size() <= AES_BLOCK_SIZE) {
+        return;
+    }
+
+    sgx_status_t ret_status;
+    if (ecall_reset_timing(global_eid, &ret_status) != SGX_SUCCESS) {
+        return;
+    }
+
+    uint32_t result_count = 0;
+    results.resize(RESULT_MODE_SIZE(g_service_result_mode, MAX_VALUES));
+    bool query_file = is_query_file(payload.data(), payload.size());
+    if (!query_file &&
+        (ecall_update_counter(global_eid, &ret_status, payload.data(), AES_BLOCK_SIZE) != SGX_SUCCESS ||
+         ret_status != SGX_SUCCESS)) {
+        return;
+    }
+
+    auto run_query = [&]() {
+        sgx_status_t call_status;
+        if (query_file) {
+            call_status = ecall_process_query_file(global_eid, &ret_status, set_id,
+                payload.data(), payload.size(), results.data(), results.size(), &result_count);
+        } else {
+            call_status = ecall_process_encrypted_queries(global_eid, &ret_status, set_id,
+                payload.data() + AES_BLOCK_SIZE, payload.size() - AES_BLOCK_SIZE,
+                results.data(), results.size(), &result_count);
+        }
+        return (call_status != SGX_SUCCESS) ? call_status : ret_status;
+    };
+
+    // Only a set that has to be reloaded waits for g_set_writes
+    sgx_status_t status = run_query();
+    if (status == SGX_ERROR_INVALID_STATE) {
+        std::lock_guard<std::mutex> lock(g_set_writes);
+        status = call_on_set(set_id, run_query);
+    }
+    if (status != SGX_SUCCESS) {
+        response.status = status;
+        return;
+    }
+
+    uint64_t total_time;
+    uint64_t index_build_time;
+    uint64_t index_memory;
+    ecall_get_timing_info(global_eid, &ret_status, set_id,
+                          &response.encryption_time_us,
+                          &response.processing_time_us,
+                          &total_time,
+                          &response.decryption_time_us,
+                          &index_build_time,
+                          &index_memory);
+
+    response.status = SGX_SUCCESS;
+    response.result_count = result_count;
+    response.payload_size = RESULT_MODE_SIZE(g_service_result_mode, result_count);
+}
+
+static void handle_request(const ServiceRequestHeader& request, const std::vector<uint8_t>& payload,
+                           ServiceResponseHeader& response, std::vector<uint8_t>& results) {
+    memset(&response, 0, sizeof(response));
+    response.magic = SERVICE_MAGIC;
+    response.result_mode = g_service_result_mode;
+    response.status = SGX_ERROR_INVALID_PARAMETER;
+
+    if (request.set_id >= g_service_sets.size()) {
+        return;
+    }
+
+    if (request.type == SERVICE_REQUEST_QUERY) {
+        handle_query(request.set_id, payload, response, results);
+    } else if (request.type == SERVICE_REQUEST_INSERT || request.type == SERVICE_REQUEST_DELETE) {
+        handle_update(request.set_id, request.type, payload, response);
+    }
+}
+
+// Answers requests on one client connection until it closes
+static void serve_connection(int client_fd) {
+    std::vector<uint8_t> payload;
+    std::vector<uint8_t> results;
+
+    while (!g_stop_service) {
+        ServiceRequestHeader request;
+        if (!read_fully(client_fd, &request, sizeof(request))) {
+            return;
+        }
+
+        if (request.magic != SERVICE_MAGIC || request.payload_size > MAX_FILE_SIZE) {
+            fprintf(stderr, "Service: dropping client after malformed request\n");
+            return;
+        }
+
+        payload.resize(request.payload_size);
+        if (!read_fully(client_fd, payload.data(), payload.size())) {
+            return;
+        }
+
+        ServiceResponseHeader response;
+        handle_request(request, payload, response, results);
+
+        if (!write_fully(client_fd, &response, sizeof(response)) ||
+            !write_fully(client_fd, results.data(), response.payload_size)) {
+            return;
+        }
+    }
+}
+
+bool run_service(const std::string& socket_path, const std::vector<std::string>& secret_files,
+                 const std::string& snapshot_file, uint32_t result_mode) {
+    g_service_result_mode = result_mode;
+    g_service_sets.clear();
+    for (size_t i = 0; i < secret_files.size(); i++) {
+        ServiceSet set;
+        set.secret_file = secret_files[i];
+        if (!snapshot_file.empty()) {
+            set.snapshot_file = snapshot_file + "." + std::to_string(i);
+            set.delta_log_file = set.snapshot_file + ".log";
+        }
+        set.delta_size = 0;
+        set.compact_queued = false;
+        set.log_stale = false;
+        g_service_sets.push_back(set);
+    }
+
+    // Every set is loaded once up front, which also writes missing snapshots;
+    // with a memory budget the earliest may be evicted again straight away
+    for (uint32_t set_id = 0; set_id < g_service_sets.size(); set_id++) {
+        if (!load_service_set(set_id)) {
+            return false;
+        }
+    }
+
+    sockaddr_un address;
+    if (!make_socket_address(socket_path, address)) {
+        fprintf(stderr, "Service: socket path too long: %s\n", socket_path.c_str());
+        return false;
+    }
+
+    int listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listen_fd < 0) {
+        perror("Service: socket");
+        return false;
+    }
+
+    // Only the owner may connect; queries and results are encrypted but the
+    // service should not be reachable by other local users
+    unlink(socket_path.c_str());
+    mode_t old_umask = umask(0077);
+    int bind_ret = bind(listen_fd, reinterpret_cast<sockaddr*>(&address), sizeof(address));
+    umask(old_umask);
+    if (bind_ret != 0 || listen(listen_fd, SOMAXCONN) != 0) {
+        perror("Service: bind/listen");
+        close(listen_fd);
+        return false;
+    }
+
+    // No SA_RESTART so a signal interrupts accept() and read()
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = handle_stop_signal;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGINT, &action, NULL);
+    sigaction(SIGTERM, &action, NULL);
+    signal(SIGPIPE, SIG_IGN);
+
+    printf("Service: listening on %s\n", socket_path.c_str());
+    fflush(stdout);
+
+    g_stop_compacting = false;
+    std::thread compaction_thread(run_compactions);
+
+    while (!g_stop_service) {
+        int client_fd = accept(listen_fd, NULL, NULL);
+        if (client_fd < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("Service: accept");
+            break;
+        }
+
+        serve_connection(client_fd);
+        close(client_fd);
+    }
+
+    // A queued compaction is dropped; its updates are in the delta log
+    {
+        std::lock_guard<std::mutex> lock(g_set_writes);
+        g_stop_compacting = true;
+        g_compaction_wanted.notify_one();
+    }
+    compaction_thread.join();
+
+    close(listen_fd);
+    unlink(socket_path.c_str());
+    printf("Service: stopped\n");
+    return true;
+}
+
+// Reads a whole test file as a request payload, counter included
+static bool read_payload_file(const std::string& path, std::vector<uint8_t>& payload) {
+    std::ifstream file(path, std::ios::binary);
+    if (!file) {
+        return false;
+    }
+
+    file.seekg(0, std::ios::end);
+    size_t file_size = file.tellg();
+    file.seekg(0, std::ios::beg);
+    if (file_size <= AES_BLOCK_SIZE || file_size > MAX_FILE_SIZE) {
+        return false;
+    }
+
+    payload.resize(file_size);
+    return static_cast<bool>(file.read(reinterpret_cast<char*>(payload.data()), payload.size()));
+}
+
+// Sends one request on a fresh connection and reads back the response and its
+// payload; false if the service cannot be reached or answers malformed
+static bool exchange_request(const std::string& socket_path, uint32_t set_id, uint32_t type,
+                             const std::vector<uint8_t>& payload, ServiceResponseHeader& response,
+                             std::vector<uint8_t>& response_payload) {
+    sockaddr_un address;
+    if (!make_socket_address(socket_path, address)) {
+        return false;
+    }
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) {
+        return false;
+    }
+
+    if (connect(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0) {
+        close(fd);
+        return false;
+    }
+
+    ServiceRequestHeader request = {SERVICE_MAGIC, type, set_id, 0, payload.size()};
+    bool query = (type == SERVICE_REQUEST_QUERY);
+    bool ok = write_fully(fd, &request, sizeof(request)) &&
+              write_fully(fd, payload.data(), payload.size()) &&
+              read_fully(fd, &response, sizeof(response)) &&
+              response.magic == SERVICE_MAGIC && response.result_mode < RESULT_MODE_COUNT &&
+              response.payload_size == (response.status == SGX_SUCCESS && query ?
+                                        RESULT_MODE_SIZE(response.result_mode,
+                                                         response.result_count) : 0);
+    if (ok) {
+        response_payload.resize(response.payload_size);
+        ok = read_fully(fd, response_payload.data(), response_payload.size());
+    }
+    close(fd);
+    return ok;
+}
+
+bool query_service(const std::string& socket_path, uint32_t set_id, const std::string& test_file,
+                   const std::vector<uint8_t>& key_data, TestResults& results) {
+    auto total_start = std::chrono::high_resolution_clock::now();
+
+    std::vector<uint8_t> payload;
+    if (!read_payload_file(test_file, payload)) {
+        return false;
+    }
+
+    ServiceResponseHeader response;
+    std::vector<uint8_t> encrypted_results;
+    bool ok = exchange_request(socket_path, set_id, SERVICE_REQUEST_QUERY, payload,
+                               response, encrypted_results);
+    if (!ok || response.status != SGX_SUCCESS) {
+        results.errors++;
+        return ok;
+    }
+
+    EVP_CIPHER_CTX* ctx = EVP_CIPHER_CTX_new();
+    if (!ctx) {
+        return false;
+    }
+
+    std::vector<uint8_t> bitmap(RESULT_BITMAP_BYTES(response.result_count));
+    if (!decrypt_and_tally_results(key_data, ctx, encrypted_results.data(), response.result_count,
+                                   response.result_mode, bitmap.data(), results)) {
+        results.errors += response.result_count;
+    }
+    EVP_CIPHER_CTX_free(ctx);
+
+    results.decryption_time_us = response.decryption_time_us;
+    results.processing_time_us = response.processing_time_us;
+    results.encryption_time_us = response.encryption_time_us;
+
+    auto total_end = std::chrono::high_resolution_clock::now();
+    results.total_time_us = std::chrono::duration_cast<std::chrono::microseconds>(
+        total_end - total_start).count();
+    // The enclave times come from the service's clock and can exceed the
+    // client's wall-clock total
+    uint64_t enclave_time_us = results.processing_time_us + results.encryption_time_us +
+                               results.decryption_time_us;
+    results.overhead_time_us = results.total_time_us > enclave_time_us ?
+                               results.total_time_us - enclave_time_us : 0;
+    return true;
+}
+
+bool update_service(const std::string& socket_path, uint32_t set_id, uint32_t type,
+                    const std::string& update_file, uint32_t* delta_size) {
+    std::vector<uint8_t> payload;
+    if (!read_payload_file(update_file, payload) || !is_query_file(payload.data(), payload.size())) {
+        fprintf(stderr, "%s is not a compact query file\n", update_file.c_str());
+        return false;
+    }
+
+    ServiceResponseHeader response;
+    std::vector<uint8_t> response_payload;
+    if (!exchange_request(socket_path, set_id, type, payload, response, response_payload)) {
+        return false;
+    }
+
+    if (response.status == SERVICE_STATUS_NOT_DURABLE) {
+        fprintf(stderr, "Service applied the update but could not persist it\n");
+        return false;
+    }
+    if (response.status != SGX_SUCCESS) {
+        fprintf(stderr, "Service rejected the update (status 0x%x)\n", response.status);
+        return false;
+    }
+
+    *delta_size = response.delta_size;
+    return true;
+}
@@ -0,0 +1,81 @@
+// Service.h
+#ifndef _SERVICE_H_
+#define _SERVICE_H_
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include "App.h"
+
+#define SERVICE_MAGIC 0x51455153  // "SQEQ"
+
+// Request types
+#define SERVICE_REQUEST_QUERY  0
+#define SERVICE_REQUEST_INSERT 1
+#define SERVICE_REQUEST_DELETE 2
+
+// Status of an insert or delete that is live in the enclave but could be
+// neither logged nor snapshotted, so a restart would lose it; outside the
+// sgx_status_t range. Resending the update is harmless.
+#define SERVICE_STATUS_NOT_DURABLE 0x80000001
+
+// Pending updates at which the service compacts them into its set, snapshot
+// and delta log on its compaction thread, which holds up further updates to
+// its sets but not queries
+#define SERVICE_COMPACT_THRESHOLD 65536
+
+// Every request on the socket is a header followed by payload_size bytes of a
+// test file exactly as value_sealer seal-tests writes it. Queries take a
+// compact query file (see QueryFileHeader) or the legacy counter plus
+// encrypted TestData; inserts and deletes take a compact query file of the
+// values to change. A connection may carry any number of requests.
+struct ServiceRequestHeader {
+    uint32_t magic;
+    uint32_t type;                // SERVICE_REQUEST_*
+    uint32_t set_id;              // Served set, by position of its --secret
+    uint32_t reserved;
+    uint64_t payload_size;
+};
+
+// Each response is this header followed by payload_size bytes of the encrypted
+// result (RESULT_MODE_SIZE(result_mode, result_count)) for a query, or no
+// payload for an update or on error
+struct ServiceResponseHeader {
+    uint32_t magic;
+    uint32_t status;              // sgx_status_t of the request, or SERVICE_STATUS_NOT_DURABLE
+    uint32_t result_count;        // Values queried or updated
+    uint32_t delta_size;          // Pending updates after an insert or delete
+    uint32_t result_mode;         // RESULT_MODE_* the service runs in
+    uint32_t reserved;
+    uint64_t decryption_time_us;  // Enclave timings for this request
+    uint64_t processing_time_us;
+    uint64_t encryption_time_us;
+    uint64_t payload_size;
+};
+
+// Loads each of secret_files into the already initialized enclave as set 0,
+// 1, ... and answers requests for them on a Unix domain socket at socket_path
+// until SIGINT or SIGTERM. A set the enclave evicted is reloaded when next
+// requested. With a snapshot_file, set N's built index is restored from the
+// sealed snapshot snapshot_file.N instead when it is newer than its secret
+// file, and written after a rebuild. Inserts and deletes are then logged to
+// snapshot_file.N.log before they are acknowledged and replayed onto the
+// snapshot on load; without a snapshot_file they last until the set is
+// evicted or the service stops. result_mode is the RESULT_MODE_* the enclave
+// was set to.
+bool run_service(const std::string& socket_path, const std::vector<std::string>& secret_files,
+                 const std::string& snapshot_file, uint32_t result_mode);
+
+// Sends test_file to a running service to run against set_id and tallies the
+// decrypted results in whichever result mode the service runs
+bool query_service(const std::string& socket_path, uint32_t set_id, const std::string& test_file,
+                   const std::vector<uint8_t>& key_data, TestResults& results);
+
+// Sends the values in update_file, a compact query file, to a running service
+// to insert into (SERVICE_REQUEST_INSERT) or delete from
+// (SERVICE_REQUEST_DELETE) set_id. delta_size receives the set's pending
+// update count afterwards.
+bool update_service(const std::string& socket_path, uint32_t set_id, uint32_t type,
+                    const std::string& update_file, uint32_t* delta_size);
+
+#endif // _SERVICE_H_
@@ -0,0 +1,105 @@
+// BulkIntersect.cpp
+#include "BulkIntersect.h"
+#include <string.h>
+#include <algorithm>
+#include <new>
+
+// Packs a query and its position so that plain integer order sorts by value.
+// Flipping the sign bit maps int ordering onto unsigned ordering.
+static inline uint64_t pack_query(int value, uint32_t position) {
+    return ((uint64_t)((uint32_t)value ^ 0x80000000u) << 32) | position;
+}
+
+static inline int unpack_value(uint64_t packed) {
+    return (int)((uint32_t)(packed >> 32) ^ 0x80000000u);
+}
+
+// A wider query and its position, sorted by value
+template <typename Key>
+struct PositionedQuery {
+    Key value;
+    uint32_t position;
+
+    bool operator<(const PositionedQuery& other) const {
+        return value < other.value;
+    }
+};
+
+// First index in [from, count) whose value is >= target. Gallops forward in
+// doubling steps and then binary searches the last step, so dense query runs
+// cost O(1) per query and sparse ones O(log gap).
+template <typename Key>
+static uint32_t gallop_lower_bound(const Key* set, uint32_t count, uint32_t from, Key target) {
+    if (from >= count || !(set[from] < target)) {
+        return from;
+    }
+
+    uint32_t low = from;  // set[low] < target
+    uint32_t step = 1;
+    while (low + step < count && set[low + step] < target) {
+        low += step;
+        step *= 2;
+    }
+
+    uint32_t high = (low + step < count) ? low + step : count;
+    return (uint32_t)(std::lower_bound(set + low + 1, set + high, target) - set);
+}
+
+template <>
+bool bulk_intersect<int>(const int* sorted_set, uint32_t set_count,
+                         const int* queries, size_t query_count, uint8_t* result_bitmap) {
+    uint64_t* sorted_queries = new (std::nothrow) uint64_t[query_count];
+    if (!sorted_queries) {
+        return false;
+    }
+
+    for (size_t i = 0; i < query_count; i++) {
+        sorted_queries[i] = pack_query(queries[i], (uint32_t)i);
+    }
+    std::sort(sorted_queries, sorted_queries + query_count);
+
+    uint32_t pos = 0;
+    for (size_t i = 0; i < query_count; i++) {
+        int value = unpack_value(sorted_queries[i]);
+        pos = gallop_lower_bound(sorted_set, set_count, pos, value);
+        if (pos < set_count && sorted_set[pos] == value) {
+            uint32_t position = (uint32_t)sorted_queries[i];
+            result_bitmap[position >> 3] |= (uint8_t)(1u << (position & 7));
+        }
+    }
+
+    memset(sorted_queries, 0, query_count * sizeof(uint64_t));  // Secure cleanup
+    delete[] sorted_queries;
+    return true;
+}
+
+template <typename Key>
+bool bulk_intersect(const Key* sorted_set, uint32_t set_count,
+                    const Key* queries, size_t query_count, uint8_t* result_bitmap) {
+    PositionedQuery<Key>* sorted_queries = new (std::nothrow) PositionedQuery<Key>[query_count];
+    if (!sorted_queries) {
+        return false;
+    }
+
+    for (size_t i = 0; i < query_count; i++) {
+        sorted_queries[i].value = queries[i];
+        sorted_queries[i].position = (uint32_t)i;
+    }
+    std::sort(sorted_queries, sorted_queries + query_count);
+
+    uint32_t pos = 0;
+    for (size_t i = 0; i < query_count; i++) {
+        pos = gallop_lower_bound(sorted_set, set_count, pos, sorted_queries[i].value);
+        if (pos < set_count && sorted_set[pos] == sorted_queries[i].value) {
+            uint32_t position = sorted_queries[i].position;
+            result_bitmap[position >> 3] |= (uint8_t)(1u << (position & 7));
+        }
+    }
+
+    memset(sorted_queries, 0, query_count * sizeof(PositionedQuery<Key>));  // Secure cleanup
+    delete[] sorted_queries;
+    return true;
+}
+
+template bool bulk_intersect<uint64_t>(const uint64_t*, uint32_t, const uint64_t*, size_t, uint8_t*);
+template bool bulk_intersect<Key128>(const Key128*, uint32_t, const Key128*, size_t, uint8_t*);
@@ -0,0 +1,23 @@
+// BulkIntersect.h
+#ifndef _BULK_INTERSECT_H_
+#define _BULK_INTERSECT_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include "KeyTypes.h"
+
+// Sets bit i of result_bitmap if queries[i] is in sorted_set; the bitmap must
+// be zeroed by the caller. The queries are sorted together with their positions
+// and then joined against the set in a single forward pass, so results land at
+// the original query positions. Returns false if the scratch buffer cannot be
+// allocated.
+template <typename Key>
+bool bulk_intersect(const Key* sorted_set, uint32_t set_count,
+                    const Key* queries, size_t query_count, uint8_t* result_bitmap);
+
+// 32-bit queries are packed with their positions into single integers
+template <>
+bool bulk_intersect<int>(const int* sorted_set, uint32_t set_count,
+                         const int* queries, size_t query_count, uint8_t* result_bitmap);
+
+#endif // _BULK_INTERSECT_H_
@@ -0,0 +1,102 @@
+// DeltaSet.cpp
+#include "DeltaSet.h"
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+
+template <typename Key>
+bool DeltaSet<Key>::contains(Key value) const {
+    return std::binary_search(m_values, m_values + m_count, value);
+}
+
+template <typename Key>
+bool DeltaSet<Key>::scan_contains(Key value) const {
+    bool found = false;
+    for (uint32_t i = 0; i < m_count; i++) {
+        found |= (m_values[i] == value);
+    }
+    return found;
+}
+
+template <typename Key>
+bool DeltaSet<Key>::insert_sorted(const Key* values, uint32_t count) {
+    if (count == 0) {
+        return true;
+    }
+
+    if (count > m_capacity - m_count) {
+        // Grow geometrically so a run of small batches stays linear overall.
+        // A fresh buffer rather than realloc lets the old one be wiped.
+        uint64_t wanted = (uint64_t)m_count + count;
+        uint64_t capacity = m_capacity ? (uint64_t)m_capacity * 2 : 1024;
+        while (capacity < wanted) {
+            capacity *= 2;
+        }
+        if (capacity > UINT32_MAX) {
+            capacity = wanted;
+        }
+
+        Key* grown = (Key*)malloc((size_t)capacity * sizeof(Key));
+        if (!grown) {
+            return false;
+        }
+
+        if (m_values) {
+            memcpy(grown, m_values, (size_t)m_count * sizeof(Key));
+            memset(m_values, 0, (size_t)m_capacity * sizeof(Key));
+            free(m_values);
+        }
+        m_values = grown;
+        m_capacity = (uint32_t)capacity;
+    }
+
+    // Merge from the back so the existing values move at most once
+    uint32_t old_pos = m_count;
+    uint32_t new_pos = count;
+    uint32_t out = m_count + count;
+    while (new_pos > 0) {
+        if (old_pos > 0 && m_values[old_pos - 1] > values[new_pos - 1]) {
+            m_values[--out] = m_values[--old_pos];
+        } else {
+            m_values[--out] = values[--new_pos];
+        }
+    }
+    m_count += count;
+    return true;
+}
+
+template <typename Key>
+void DeltaSet<Key>::erase_sorted(const Key* values, uint32_t count) {
+    if (count == 0) {
+        return;
+    }
+
+    uint32_t out = 0;
+    uint32_t next = 0;
+    for (uint32_t i = 0; i < m_count; i++) {
+        while (next < count && values[next] < m_values[i]) {
+            next++;
+        }
+        if (next < count && values[next] == m_values[i]) {
+            continue;
+        }
+        m_values[out++] = m_values[i];
+    }
+
+    memset(m_values + out, 0, (size_t)(m_count - out) * sizeof(Key));
+    m_count = out;
+}
+
+template <typename Key>
+void DeltaSet<Key>::clear() {
+    if (m_values) {
+        memset(m_values, 0, (size_t)m_capacity * sizeof(Key));
+        free(m_values);
+    }
+    m_values = nullptr;
+    m_count = 0;
+    m_capacity = 0;
+}
+
+#define INSTANTIATE(Key) template class DeltaSet<Key>;
+INSTANTIATE_KEY_TYPES(INSTANTIATE)
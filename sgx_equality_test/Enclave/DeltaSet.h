@@ -0,0 +1,47 @@
+// DeltaSet.h
+#ifndef _DELTA_SET_H_
+#define _DELTA_SET_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include "KeyTypes.h"
+
+// Sorted, duplicate-free set of values changed in sorted batches. Holds the
+// values inserted into or deleted from the secret set since it was last
+// compacted, so every operation costs O(log size) or O(size + batch) and
+// never touches the secret set itself.
+template <typename Key>
+class DeltaSet {
+public:
+    DeltaSet() : m_values(nullptr), m_count(0), m_capacity(0) {}
+    ~DeltaSet() { clear(); }
+
+    bool contains(Key value) const;
+
+    // Same answer as contains, comparing value against every value with no
+    // early exit, so the time and accesses depend only on size()
+    bool scan_contains(Key value) const;
+
+    // Merges count sorted values, none of them already present. Returns false
+    // and leaves the set unchanged if it cannot grow.
+    bool insert_sorted(const Key* values, uint32_t count);
+
+    // Removes count sorted values, all of them present
+    void erase_sorted(const Key* values, uint32_t count);
+
+    // Wipes and frees the values
+    void clear();
+
+    const Key* values() const { return m_values; }
+    uint32_t size() const { return m_count; }
+
+private:
+    DeltaSet(const DeltaSet&);
+    DeltaSet& operator=(const DeltaSet&);
+
+    Key* m_values;
+    uint32_t m_count;
+    uint32_t m_capacity;
+};
+
+#endif // _DELTA_SET_H_
@@ -0,0 +1,287 @@
+// EliasFanoIndex.cpp
+#include "LookupIndex.h"
+#include <stdlib.h>
+#include <string.h>
+#include <new>
+
+#define ZERO_SAMPLE_RATE 64  // Zeros of the upper bits between select samples
+
+// Splits a key into its key_prefix, which is Elias-Fano coded, and a suffix
+// stored raw. Only Key128 has a suffix: its low half is as random as a digest
+// gets and would not compress anyway.
+template <typename Key> struct CompressedKey;
+
+template <> struct CompressedKey<int> {
+    static const bool HAS_SUFFIX = false;
+    static uint64_t prefix(int value) { return key_prefix(value); }
+    static uint64_t suffix(int) { return 0; }
+    static int make(uint64_t prefix, uint64_t) { return (int)((uint32_t)prefix ^ 0x80000000u); }
+};
+
+template <> struct CompressedKey<uint64_t> {
+    static const bool HAS_SUFFIX = false;
+    static uint64_t prefix(uint64_t value) { return key_prefix(value); }
+    static uint64_t suffix(uint64_t) { return 0; }
+    static uint64_t make(uint64_t prefix, uint64_t) { return prefix; }
+};
+
+template <> struct CompressedKey<Key128> {
+    static const bool HAS_SUFFIX = true;
+    static uint64_t prefix(const Key128& value) { return key_prefix(value); }
+    static uint64_t suffix(const Key128& value) { return value.lo; }
+    static Key128 make(uint64_t prefix, uint64_t suffix) { Key128 key = {prefix, suffix}; return key; }
+};
+
+// Elias-Fano coding of the sorted key prefixes, less the smallest: each is
+// split into its low m_low_bits bits, packed back to back, and the rest,
+// stored in unary as bit (high + i) of the upper bit vector for value i. For
+// n values spread over a range u that takes 2 + log2(u/n) bits a value, so a
+// dense 32-bit set shrinks several times over and a random one still by half.
+//
+// The values with a given high part h are the run of ones after the h-th
+// zero of the upper bits, so a lookup is one sampled select plus a scan of
+// that run, which holds about one value; its rank falls out as the number of
+// ones passed. The index keeps no other copy of the values and decodes them
+// for read_values. Its layout depends on the values, not just their count,
+// so a snapshot carries the values and a restore rebuilds it.
+template <typename Key>
+class EliasFanoIndex : public LookupIndex<Key> {
+public:
+    EliasFanoIndex()
+        : m_block(nullptr), m_bytes(0), m_count(0), m_base(0), m_low_bits(0), m_low_mask(0),
+          m_upper_bits(0), m_max_high(0), m_low(nullptr), m_upper(nullptr), m_zero_samples(nullptr),
+          m_suffixes(nullptr) {}
+
+    ~EliasFanoIndex() {
+        if (m_block) {
+            memset(m_block, 0, m_bytes);  // Secure cleanup
+            free(m_block);
+        }
+    }
+
+    bool build(const Key* sorted_values, uint32_t count) {
+        typedef CompressedKey<Key> Codec;
+        m_count = count;
+        m_base = Codec::prefix(sorted_values[0]);
+        uint64_t range = Codec::prefix(sorted_values[count - 1]) - m_base;
+        uint64_t spacing = range / count;
+        m_low_bits = spacing ? 63 - __builtin_clzll(spacing) : 0;
+        m_low_mask = (m_low_bits == 0) ? 0 : (~0ULL >> (64 - m_low_bits));
+
+        // Every high part is at most range >> m_low_bits < 2 * count
+        m_max_high = range >> m_low_bits;
+        m_upper_bits = count + m_max_high + 1;
+        uint64_t zeros = (range >> m_low_bits) + 1;
+        size_t low_words = ((uint64_t)count * m_low_bits + 63) / 64 + 1;
+        size_t upper_words = (m_upper_bits + 63) / 64;
+        size_t sample_count = (zeros + ZERO_SAMPLE_RATE - 1) / ZERO_SAMPLE_RATE;
+        size_t suffix_count = Codec::HAS_SUFFIX ? count : 0;
+
+        size_t low_bytes = low_words * sizeof(uint64_t);
+        size_t upper_bytes = upper_words * sizeof(uint64_t);
+        size_t suffix_bytes = suffix_count * sizeof(uint64_t);
+        size_t sample_bytes = sample_count * sizeof(uint32_t);
+        m_bytes = low_bytes + upper_bytes + suffix_bytes + sample_bytes;
+        m_bytes = (m_bytes + CACHE_LINE_SIZE - 1) & ~(size_t)(CACHE_LINE_SIZE - 1);
+
+        void* ptr = NULL;
+        if (posix_memalign(&ptr, CACHE_LINE_SIZE, m_bytes) != 0) {
+            return false;
+        }
+        m_block = (uint8_t*)ptr;
+        memset(m_block, 0, m_bytes);
+        m_low = (uint64_t*)m_block;
+        m_upper = (uint64_t*)(m_block + low_bytes);
+        m_suffixes = suffix_count ? (uint64_t*)(m_block + low_bytes + upper_bytes) : nullptr;
+        m_zero_samples = (uint32_t*)(m_block + low_bytes + upper_bytes + suffix_bytes);
+
+        for (uint32_t i = 0; i < count; i++) {
+            uint64_t offset = Codec::prefix(sorted_values[i]) - m_base;
+            uint64_t high = (offset >> m_low_bits) + i;
+            m_upper[high / 64] |= 1ULL << (high % 64);
+            set_low(i, offset & m_low_mask);
+            if (m_suffixes) {
+                m_suffixes[i] = Codec::suffix(sorted_values[i]);
+            }
+        }
+
+        uint64_t zero = 0;
+        for (uint64_t bit = 0; bit < m_upper_bits; bit++) {
+            if (!(m_upper[bit / 64] & (1ULL << (bit % 64)))) {
+                if (zero % ZERO_SAMPLE_RATE == 0) {
+                    m_zero_samples[zero / ZERO_SAMPLE_RATE] = (uint32_t)bit;
+                }
+                zero++;
+            }
+        }
+        return true;
+    }
+
+    bool contains(Key value) const {
+        return find(value) >= 0;
+    }
+
+    int64_t find(Key value) const {
+        typedef CompressedKey<Key> Codec;
+        uint64_t prefix = Codec::prefix(value);
+        uint64_t offset = prefix - m_base;
+        uint64_t high = offset >> m_low_bits;
+        if (prefix < m_base || high > m_max_high) {
+            return -1;
+        }
+
+        uint64_t low = offset & m_low_mask;
+        uint64_t suffix = Codec::suffix(value);
+
+        // The run of values with this high part starts after its high-th zero
+        // (counting from 0 as the (high - 1)-th); every bit before it that is
+        // not one of the high zeros is a value
+        uint64_t bit = high ? select_zero(high - 1) + 1 : 0;
+        uint64_t i = bit - high;
+        while (bit < m_upper_bits && (m_upper[bit / 64] & (1ULL << (bit % 64)))) {
+            uint64_t current = get_low(i);
+            if (current > low) {
+                break;
+            }
+            if (current == low) {
+                if (!Codec::HAS_SUFFIX) {
+                    return (int64_t)i;
+                }
+                if (m_suffixes[i] == suffix) {
+                    return (int64_t)i;
+                }
+                if (m_suffixes[i] > suffix) {
+                    break;
+                }
+            }
+            bit++;
+            i++;
+        }
+        return -1;
+    }
+
+    size_t memory_bytes() const {
+        return m_bytes;
+    }
+
+    void* storage() {
+        return nullptr;
+    }
+
+    bool holds_values() const {
+        return true;
+    }
+
+    bool read_values(uint32_t first, uint32_t count, Key* out) const {
+        if (first > m_count || count > m_count - first) {
+            return false;
+        }
+        if (count == 0) {
+            return true;
+        }
+
+        // Walk the upper bits, counting the ones up to value first, then
+        // decode the following count values in order
+        uint64_t seen = 0;
+        uint64_t word = 0;
+        uint64_t ones = __builtin_popcountll(m_upper[0]);
+        while (seen + ones <= first) {
+            seen += ones;
+            ones = __builtin_popcountll(m_upper[++word]);
+        }
+
+        uint64_t bits = m_upper[word];
+        for (uint64_t skip = first - seen; skip > 0; skip--) {
+            bits &= bits - 1;
+        }
+
+        for (uint32_t i = first; i < first + count; i++) {
+            while (bits == 0) {
+                bits = m_upper[++word];
+            }
+            uint64_t bit = word * 64 + __builtin_ctzll(bits);
+            bits &= bits - 1;
+
+            uint64_t offset = ((bit - i) << m_low_bits) | get_low(i);
+            out[i - first] = CompressedKey<Key>::make(m_base + offset, m_suffixes ? m_suffixes[i] : 0);
+        }
+        return true;
+    }
+
+private:
+    uint64_t get_low(uint64_t i) const {
+        if (m_low_bits == 0) {
+            return 0;
+        }
+        uint64_t bit = i * m_low_bits;
+        uint64_t shift = bit % 64;
+        uint64_t low = m_low[bit / 64] >> shift;
+        if (shift + m_low_bits > 64) {
+            low |= m_low[bit / 64 + 1] << (64 - shift);
+        }
+        return low & m_low_mask;
+    }
+
+    void set_low(uint64_t i, uint64_t low) {
+        if (m_low_bits == 0) {
+            return;
+        }
+        uint64_t bit = i * m_low_bits;
+        uint64_t shift = bit % 64;
+        m_low[bit / 64] |= low << shift;
+        if (shift + m_low_bits > 64) {
+            m_low[bit / 64 + 1] |= low >> (64 - shift);
+        }
+    }
+
+    // Position of zero number rank (from 0) in the upper bits: the sample at
+    // or before it, then whole words by popcount, then bit by bit in the last
+    uint64_t select_zero(uint64_t rank) const {
+        uint64_t bit = m_zero_samples[rank / ZERO_SAMPLE_RATE];
+        uint64_t left = rank % ZERO_SAMPLE_RATE;
+        uint64_t word = bit / 64;
+        uint64_t zeros = ~m_upper[word] & (~0ULL << (bit % 64));
+        uint64_t in_word = __builtin_popcountll(zeros);
+        while (in_word <= left) {
+            left -= in_word;
+            zeros = ~m_upper[++word];
+            in_word = __builtin_popcountll(zeros);
+        }
+        for (; left > 0; left--) {
+            zeros &= zeros - 1;
+        }
+        return word * 64 + __builtin_ctzll(zeros);
+    }
+
+    uint8_t* m_block;  // One allocation for the arrays below
+    size_t m_bytes;
+    uint32_t m_count;
+    uint64_t m_base;   // Smallest prefix
+    uint32_t m_low_bits;
+    uint64_t m_low_mask;
+    uint64_t m_upper_bits;
+    uint64_t m_max_high;        // High part of the largest value
+    uint64_t* m_low;            // m_count fields of m_low_bits bits
+    uint64_t* m_upper;          // m_upper_bits bits
+    uint32_t* m_zero_samples;   // Position of every ZERO_SAMPLE_RATE-th zero of m_upper
+    uint64_t* m_suffixes;       // Key128 low halves, else nullptr
+};
+
+template <typename Key>
+LookupIndex<Key>* create_elias_fano_index(const Key* sorted_values, uint32_t count) {
+    EliasFanoIndex<Key>* index = new (std::nothrow) EliasFanoIndex<Key>();
+    if (!index) {
+        return nullptr;
+    }
+
+    if (!index->build(sorted_values, count)) {
+        delete index;
+        return nullptr;
+    }
+
+    return index;
+}
+
+#define INSTANTIATE(Key) \
+    template LookupIndex<Key>* create_elias_fano_index(const Key*, uint32_t);
+INSTANTIATE_KEY_TYPES(INSTANTIATE)
@@ -1,6 +1,9 @@
 // Enclave.cpp
 #include "Enclave_t.h"
 #include "../common/shared_types.h"
+#include "LookupIndex.h"
+#include "BulkIntersect.h"
+#include "DeltaSet.h"
 #include <sgx_trts.h>
 #include <sgx_tseal.h>
 #include <string.h>
@@ -8,205 +11,2527 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <algorithm>
+#include <atomic>
+#include <new>
 
-static SecretData* g_secret_data = nullptr;
-static bool g_is_initialized = false;
-static uint64_t g_page_fault_count = 0;
+// Sorted values, index and pending updates of a set, for one key type
+template <typename Key>
+struct SetKeys {
+    Key* values;              // Sorted, count entries; nullptr when the index holds them
+    LookupIndex<Key>* index;  // Built for the set's engine, nullptr for linear
+
+    // Updates applied since the set was loaded or last compacted; queries see
+    // (values - deletes) + inserts
+    DeltaSet<Key> inserts;    // None of them in values
+    DeltaSet<Key> deletes;    // All of them in values
+};
+
+// One version of a secret set resident in the enclave under a host-chosen id;
+// query ecalls name the set they run against. Reloading or compacting a set
+// publishes a new version and retires the old one, which stays intact until
+// every query that could have found it has returned.
+struct SecretSet {
+    uint32_t id;
+    uint32_t key_type;  // KEY_TYPE_*; only the matching keys below are in use
+    uint32_t count;
+    SetKeys<int> int32_keys;
+    SetKeys<uint64_t> uint64_keys;
+    SetKeys<Key128> digest128_keys;
+    uint32_t* payloads;  // Parallel to the sorted values for a keyed set, else nullptr
+    EngineReport engine_report;  // Engine of the index, with its calibration if chosen automatically
+
+    // Each batch of updates applied is one record of delta log generation,
+    // numbered by sequence
+    uint64_t generation;
+    uint32_t sequence;
+
+    uint64_t snapshot_id;  // Random, in every chunk of a snapshot of this version
+
+    std::atomic<uint64_t> last_used;  // g_use_clock when last queried or loaded
+
+    uint64_t retired_epoch;   // g_epoch when unpublished
+    SecretSet* next_retired;  // In g_retired_sets
+};
+
+template <typename Key> static SetKeys<Key>& keys_of(SecretSet& set);
+template <> SetKeys<int>& keys_of<int>(SecretSet& set) { return set.int32_keys; }
+template <> SetKeys<uint64_t>& keys_of<uint64_t>(SecretSet& set) { return set.uint64_keys; }
+template <> SetKeys<Key128>& keys_of<Key128>(SecretSet& set) { return set.digest128_keys; }
+
+template <typename Key>
+static const SetKeys<Key>& keys_of(const SecretSet& set) {
+    return keys_of<Key>(const_cast<SecretSet&>(set));
+}
+
+// Query ecalls may run concurrently on separate TCS slots. They only read the
+// secret sets, indexes and key; anything they write is atomic. Loading,
+// compacting, evicting or releasing a set publishes a new version of its slot
+// and may overlap with queries. Updating or replaying into a set, switching
+// engine or mode and cleanup change sets in place and must not. Calls that
+// change sets never overlap with one another.
+static std::atomic<SecretSet*> g_sets[MAX_SECRET_SETS];  // nullptr while free
+static SecretSet* g_retired_sets = nullptr;  // Unpublished versions not yet freed
+static std::atomic_flag g_retired_lock = ATOMIC_FLAG_INIT;  // Guards g_retired_sets
+static std::atomic<uint64_t> g_retired_bytes(0);  // Held by g_retired_sets, within the budget
+static std::atomic<uint64_t> g_use_clock(0);
+static uint64_t g_memory_budget = 0;  // Bytes for all sets, 0 = unlimited
+static std::atomic<uint64_t> g_page_fault_count(0);
+static uint32_t g_lookup_engine = LOOKUP_ENGINE_LINEAR;
+static uint32_t g_batch_mode = BATCH_MODE_LOOKUP;
+static uint32_t g_result_mode = RESULT_MODE_BITMAP;
+static uint32_t g_result_threshold = 0;  // Matches RESULT_MODE_THRESHOLD asks for
+
+// Set being streamed in through ecall_begin/append/commit_secret_data, as
+// g_ingest_count values of g_ingest_key_type
+static uint32_t g_ingest_set_id = 0;
+static uint32_t g_ingest_key_type = KEY_TYPE_INT32;
+static uint8_t* g_ingest_values = nullptr;
+static uint32_t* g_ingest_payloads = nullptr;  // Only for a keyed set
+static uint32_t g_ingest_count = 0;
+static uint32_t g_ingest_filled = 0;
+static uint32_t g_ingest_payloads_filled = 0;
+
+// Snapshot being restored through ecall_import_index_snapshot; its values go
+// to g_ingest_values
+static uint32_t g_snapshot_set_id = 0;
+static IndexSnapshotHeader g_snapshot_header;
+static LookupIndexStorage* g_snapshot_index = nullptr;
+static uint32_t g_snapshot_next_chunk = 0;
+
+// Shards of the set being ingested through ecall_begin/ingest/commit_secret_shards,
+// staged in g_ingest_values: shard i fills the entries from g_shard_offsets[i]
+// up to g_shard_offsets[i + 1]. Ingesting different shards may overlap, as
+// each call only writes its own entries and claims its shard atomically.
+static uint32_t g_shard_count = 0;  // 0 unless shards are being ingested
+static uint32_t g_shard_offsets[MAX_SECRET_SHARDS + 1];
+static std::atomic<uint32_t> g_shard_claimed[MAX_SECRET_SHARDS];  // 1 once ingest began
+static std::atomic<uint32_t> g_shards_filled(0);
+
+// Shard ingests copying into g_ingest_values, plus INGEST_CLOSED while a call
+// holding an IngestSection stages, commits or drops the ingest
+#define INGEST_CLOSED 0x80000000u
+static std::atomic<uint32_t> g_ingest_users(0);
 
 // AES key and counter definitions
 #define AES_KEY_SIZE 16  // 128 bits
 #define AES_BLOCK_SIZE 16
 #define CHUNK_SIZE 8192  // Process data in 8KB chunks for better memory management
+#define AUTO_CALIBRATION_LOOKUPS 8192  // Timed lookups per candidate engine
+#define AUTO_LINEAR_MAX_COUNT 256      // Largest set LOOKUP_ENGINE_AUTO tries to scan
+#define MAX_READERS 16                 // TCSNum in Enclave.config.xml bounds concurrent queries
+
+static uint8_t g_aes_key[AES_KEY_SIZE];
+static uint8_t g_aes_counter[AES_BLOCK_SIZE];
+static bool g_aes_initialized = false;
+
+// Times from concurrent calls add up, so they are CPU time rather than wall time
+struct TimingInfo {
+    std::atomic<uint64_t> encryption_time;
+    std::atomic<uint64_t> decryption_time;
+    std::atomic<uint64_t> processing_time;
+    std::atomic<uint64_t> total_time;
+    std::atomic<uint64_t> index_build_time;
+};
+
+static TimingInfo g_timing;  // Zero-initialized
+
+// Helper function to get minimum of two values
+static inline size_t min_size_t(size_t a, size_t b) {
+    return (a < b) ? a : b;
+}
+
+// Helper function for aligned memory allocation
+static void* aligned_malloc(size_t size, size_t alignment) {
+    void* ptr = NULL;
+    if (posix_memalign(&ptr, alignment, size) != 0) {
+        return NULL;
+    }
+    return ptr;
+}
+
+// Helper function to format and print messages
+void print_debug(const char* format, ...) {
+    char buf[1024];
+    va_list ap;
+    va_start(ap, format);
+    vsnprintf(buf, sizeof(buf), format, ap);
+    va_end(ap);
+    ocall_print_string(buf);
+}
+
+// Securely wipes and frees a values array of count entries
+template <typename Key>
+static void free_values(Key*& values, uint32_t count) {
+    if (values) {
+        memset(values, 0, (size_t)count * sizeof(Key));
+        free(values);
+        values = nullptr;
+    }
+}
+
+// Drops the pending updates and starts delta log generation at sequence 0
+template <typename Key>
+static void reset_delta_log(SecretSet& set, uint64_t generation) {
+    keys_of<Key>(set).inserts.clear();
+    keys_of<Key>(set).deletes.clear();
+    set.generation = generation;
+    set.sequence = 0;
+}
+
+// Drops the values, index and pending updates of one key type
+template <typename Key>
+static void release_keys(SetKeys<Key>& keys, uint32_t count) {
+    delete keys.index;
+    keys.index = nullptr;
+    free_values(keys.values, count);
+    keys.inserts.clear();
+    keys.deletes.clear();
+}
+
+// Drops a set's values, index and pending updates
+static void release_set(SecretSet& set) {
+    release_keys(set.int32_keys, set.count);
+    release_keys(set.uint64_keys, set.count);
+    release_keys(set.digest128_keys, set.count);
+    free_values(set.payloads, set.count);
+    memset(&set.engine_report, 0, sizeof(set.engine_report));
+    set.count = 0;
+    set.generation = 0;
+    set.sequence = 0;
+}
+
+// Held by a call that stages, commits or drops the ingest. It is only taken
+// while no shard ingest is counted in and keeps new ones out, so the staging
+// buffer cannot be freed or replaced under a copy into it; two such calls
+// also exclude each other.
+class IngestSection {
+public:
+    explicit IngestSection(bool wait = false) {
+        uint32_t idle = 0;
+        while (!(m_held = g_ingest_users.compare_exchange_strong(idle, INGEST_CLOSED)) && wait) {
+            idle = 0;
+        }
+    }
+
+    ~IngestSection() {
+        if (m_held) {
+            g_ingest_users.fetch_and(~INGEST_CLOSED);
+        }
+    }
+
+    bool held() const {
+        return m_held;
+    }
+
+private:
+    bool m_held;
+};
+
+// Drops a set whose ingest was begun but not committed; the caller holds an
+// IngestSection
+static void release_ingest() {
+    free_values(g_ingest_values, g_ingest_count * (uint32_t)KEY_TYPE_SIZE(g_ingest_key_type));
+    free_values(g_ingest_payloads, g_ingest_count);
+    g_ingest_count = 0;
+    g_ingest_filled = 0;
+    g_ingest_payloads_filled = 0;
+    for (uint32_t i = 0; i < g_shard_count; i++) {
+        g_shard_claimed[i] = 0;
+    }
+    g_shard_count = 0;
+    g_shards_filled = 0;
+}
+
+// Drops a snapshot whose import was begun but not completed
+static void release_snapshot_import() {
+    delete g_snapshot_index;  // Wipes the storage
+    g_snapshot_index = nullptr;
+    g_snapshot_next_chunk = 0;
+    release_ingest();
+}
+
+// Epoch-based reclamation of retired set versions. A query holds a reader
+// slot stamped with the epoch it began in while it uses a set, and each
+// version retired advances the epoch. A version retired in epoch e can only
+// have been found by queries stamped e or earlier, so it is freed once no
+// reader holds such a stamp: by the publish that retires it if no query
+// holds it, else by the query that leaves last. Entering and leaving cost a
+// query one atomic each while nothing is retired; it never waits for a writer.
+static std::atomic<uint64_t> g_epoch(1);
+static std::atomic<uint64_t> g_reader_epochs[MAX_READERS];  // 0 while free
+
+template <typename Key>
+static uint64_t set_memory_bytes(const SecretSet& set);
+
+// Frees the retired versions no query can still be using; the caller holds
+// g_retired_lock
+static void reclaim_retired_sets_locked() {
+    uint64_t oldest = UINT64_MAX;
+    for (std::atomic<uint64_t>& reader : g_reader_epochs) {
+        uint64_t epoch = reader.load();
+        if (epoch != 0 && epoch < oldest) {
+            oldest = epoch;
+        }
+    }
+
+    SecretSet** link = &g_retired_sets;
+    while (*link) {
+        SecretSet* set = *link;
+        if (set->retired_epoch < oldest) {
+            *link = set->next_retired;
+            g_retired_bytes.fetch_sub(DISPATCH_KEY_TYPE(set->key_type, set_memory_bytes, (*set)));
+            release_set(*set);
+            delete set;
+        } else {
+            link = &set->next_retired;
+        }
+    }
+}
+
+static void reclaim_retired_sets() {
+    while (g_retired_lock.test_and_set()) {
+    }
+    reclaim_retired_sets_locked();
+    g_retired_lock.clear();
+}
+
+// Held by a query ecall for as long as it uses the set it found
+class ReadSection {
+public:
+    ReadSection() {
+        // Each query ecall holds a TCS, so a slot is always free
+        for (uint32_t i = 0; ; i = (i + 1) % MAX_READERS) {
+            uint64_t free_slot = 0;
+            if (g_reader_epochs[i].compare_exchange_strong(free_slot, g_epoch.load())) {
+                m_slot = i;
+                return;
+            }
+        }
+    }
+
+    // A query leaving while versions are retired frees those it was the
+    // last to hold. If a writer is reclaiming at the same moment, whichever
+    // of the two runs later frees them.
+    ~ReadSection() {
+        g_reader_epochs[m_slot].store(0);
+        if (g_retired_bytes.load() != 0 && !g_retired_lock.test_and_set()) {
+            reclaim_retired_sets_locked();
+            g_retired_lock.clear();
+        }
+    }
+
+private:
+    uint32_t m_slot;
+};
+
+// Makes set, or nullptr to free the slot, the version queries find in slot.
+// The version it replaces is retired; it is freed here if no query can have
+// found it, else by the last of those queries as it returns.
+static void publish_set(std::atomic<SecretSet*>& slot, SecretSet* set) {
+    SecretSet* old = slot.exchange(set);
+    while (g_retired_lock.test_and_set()) {
+    }
+    if (old) {
+        old->retired_epoch = g_epoch.fetch_add(1);
+        old->next_retired = g_retired_sets;
+        g_retired_sets = old;
+        g_retired_bytes.fetch_add(DISPATCH_KEY_TYPE(old->key_type, set_memory_bytes, (*old)));
+    }
+    reclaim_retired_sets_locked();
+    g_retired_lock.clear();
+}
+
+// The slot holding the set with the given id, or nullptr if it is not resident
+static std::atomic<SecretSet*>* slot_of(uint32_t id) {
+    for (std::atomic<SecretSet*>& slot : g_sets) {
+        SecretSet* set = slot.load();
+        if (set && set->id == id) {
+            return &slot;
+        }
+    }
+    return nullptr;
+}
+
+// The loaded set with the given id, or nullptr if it is not resident. A query
+// must hold a ReadSection until it is done with the set.
+static SecretSet* find_set(uint32_t id) {
+    for (std::atomic<SecretSet*>& slot : g_sets) {
+        SecretSet* set = slot.load();
+        if (set && set->id == id) {
+            return set;
+        }
+    }
+    return nullptr;
+}
+
+// find_set for a query, marking the set most recently used
+static SecretSet* use_set(uint32_t id) {
+    SecretSet* set = find_set(id);
+    if (set) {
+        set->last_used.store(g_use_clock.fetch_add(1, std::memory_order_relaxed) + 1,
+                             std::memory_order_relaxed);
+    }
+    return set;
+}
+
+// Enclave memory held by count values of key_size bytes, their payloads if
+// keyed and their index once loaded
+static uint64_t loaded_bytes(uint32_t count, size_t key_size, bool keyed,
+                             const LookupIndexStorage* index) {
+    uint64_t payload_bytes = keyed ? (uint64_t)count * PAYLOAD_SIZE : 0;
+    if (!index) {
+        return (uint64_t)count * key_size + payload_bytes;
+    }
+    return index->memory_bytes() + (index->holds_values() ? 0 : (uint64_t)count * key_size) +
+           payload_bytes;
+}
+
+// Enclave memory held by a set, counted against the memory budget
+template <typename Key>
+static uint64_t set_memory_bytes(const SecretSet& set) {
+    const SetKeys<Key>& keys = keys_of<Key>(set);
+    return loaded_bytes(set.count, sizeof(Key), set.payloads != nullptr, keys.index) +
+           ((uint64_t)keys.inserts.size() + keys.deletes.size()) * sizeof(Key);
+}
+
+// Enclave memory held by a set's index alone
+template <typename Key>
+static uint64_t index_memory_bytes(const SecretSet& set) {
+    const LookupIndex<Key>* index = keys_of<Key>(set).index;
+    return index ? index->memory_bytes() : 0;
+}
+
+// Copies count values of the set as loaded, starting at first, into out
+template <typename Key>
+static bool read_set_values(const SecretSet& set, uint32_t first, uint32_t count, Key* out) {
+    const SetKeys<Key>& keys = keys_of<Key>(set);
+    if (keys.values) {
+        memcpy(out, keys.values + first, (size_t)count * sizeof(Key));
+        return true;
+    }
+    return keys.index && keys.index->read_values(first, count, out);
+}
+
+// A copy of the values of a set whose index holds them, or nullptr
+template <typename Key>
+static Key* copy_set_values(const SecretSet& set) {
+    Key* values = (Key*)aligned_malloc((size_t)set.count * sizeof(Key), 16);
+    if (values && !read_set_values(set, 0, set.count, values)) {
+        free_values(values, set.count);
+    }
+    return values;
+}
+
+// Picks the slot set id is loaded into, evicting the least recently used other
+// sets until bytes more fit in the memory budget and a slot is free. A set
+// already loaded under id is about to be replaced, so it does not count and
+// its slot is reused. Retired versions queries still hold do count; once no
+// other set is left to evict, this waits for those queries to return. Returns
+// nullptr if bytes exceed the whole budget.
+static std::atomic<SecretSet*>* make_room(uint32_t id, uint64_t bytes) {
+    if (g_memory_budget != 0 && bytes > g_memory_budget) {
+        return nullptr;
+    }
+
+    for (;;) {
+        uint64_t used = g_retired_bytes.load();
+        std::atomic<SecretSet*>* own = nullptr;
+        std::atomic<SecretSet*>* free_slot = nullptr;
+        std::atomic<SecretSet*>* lru = nullptr;
+        uint64_t lru_used = 0;
+        for (std::atomic<SecretSet*>& slot : g_sets) {
+            SecretSet* set = slot.load();
+            if (!set) {
+                free_slot = free_slot ? free_slot : &slot;
+            } else if (set->id == id) {
+                own = &slot;
+            } else {
+                used += DISPATCH_KEY_TYPE(set->key_type, set_memory_bytes, (*set));
+                if (!lru || set->last_used < lru_used) {
+                    lru = &slot;
+                    lru_used = set->last_used;
+                }
+            }
+        }
+
+        std::atomic<SecretSet*>* slot = own ? own : free_slot;
+        if (slot && (g_memory_budget == 0 || used + bytes <= g_memory_budget)) {
+            return slot;
+        }
+        if (lru) {
+            publish_set(*lru, nullptr);
+        } else {
+            reclaim_retired_sets();  // Only retired versions hold the budget
+        }
+    }
+}
+
+// Publishes a freshly loaded set in slot, retiring whatever it held, and takes
+// ownership of values, payloads (nullptr unless keyed) and index, built as
+// report says; they are freed if it fails. An index that holds the values
+// replaces them, so the array is wiped and freed.
+template <typename Key>
+static sgx_status_t install_set(std::atomic<SecretSet*>& slot, uint32_t id, Key* values,
+                                uint32_t* payloads, uint32_t count, LookupIndex<Key>* index,
+                                const EngineReport& report, uint64_t generation) {
+    if (index && index->holds_values()) {
+        free_values(values, count);
+    }
+    uint64_t snapshot_id;
+    sgx_status_t ret = sgx_read_rand((unsigned char*)&snapshot_id, sizeof(snapshot_id));
+    SecretSet* set = (ret == SGX_SUCCESS) ? new (std::nothrow) SecretSet() : nullptr;
+    if (!set) {
+        delete index;
+        free_values(values, count);
+        free_values(payloads, count);
+        return (ret == SGX_SUCCESS) ? SGX_ERROR_OUT_OF_MEMORY : ret;
+    }
+
+    SetKeys<Key>& keys = keys_of<Key>(*set);
+    set->id = id;
+    set->key_type = KeyType<Key>::id;
+    set->count = count;
+    keys.values = values;
+    keys.index = index;
+    set->payloads = payloads;
+    set->engine_report = report;
+    set->snapshot_id = snapshot_id;
+    reset_delta_log<Key>(*set, generation);
+    set->last_used = g_use_clock.fetch_add(1, std::memory_order_relaxed) + 1;
+    publish_set(slot, set);
+    return SGX_SUCCESS;
+}
+
+// Builds the index for engine over sorted values into index, or sets it to
+// nullptr for the linear engine, and records the build time
+template <typename Key>
+static sgx_status_t build_lookup_index(uint32_t engine, const Key* values, uint32_t count,
+                                       LookupIndex<Key>** index) {
+    *index = nullptr;
+    g_timing.index_build_time = 0;
+
+    if (engine == LOOKUP_ENGINE_LINEAR) {
+        return SGX_SUCCESS;
+    }
+
+    uint64_t retval;
+    uint64_t build_start;
+    if (ocall_get_current_time(&retval, &build_start) != SGX_SUCCESS) {
+        return SGX_ERROR_UNEXPECTED;
+    }
+
+    *index = create_lookup_index(engine, values, count);
+    if (!*index) {
+        return SGX_ERROR_OUT_OF_MEMORY;
+    }
+
+    uint64_t build_end;
+    if (ocall_get_current_time(&retval, &build_end) != SGX_SUCCESS) {
+        delete *index;
+        *index = nullptr;
+        return SGX_ERROR_UNEXPECTED;
+    }
+    g_timing.index_build_time = build_end - build_start;
+
+    return SGX_SUCCESS;
+}
+
+// Whether Elias-Fano coding, at about 2 + log2(range / count) bits a value
+// plus the key bits past the 64-bit prefix, takes less than the values
+static bool elias_fano_compresses(uint64_t range, uint32_t count, size_t key_size) {
+    uint64_t spacing = range / count;
+    uint64_t bits = 2 + (spacing ? 63 - __builtin_clzll(spacing) : 0);
+    if (key_size > sizeof(uint64_t)) {
+        bits += (key_size - sizeof(uint64_t)) * 8;
+    }
+    return bits < key_size * 8;
+}
+
+// Queries the calibration times: values of the set, picked by hash, each
+// followed by the same value with its lowest bit flipped, which lies within
+// the set's range and mostly misses
+template <typename Key>
+static Key* calibration_queries(const Key* values, uint32_t count) {
+    Key* queries = (Key*)malloc(AUTO_CALIBRATION_LOOKUPS * sizeof(Key));
+    if (!queries) {
+        return nullptr;
+    }
+
+    for (size_t i = 0; i < AUTO_CALIBRATION_LOOKUPS; i += 2) {
+        queries[i] = values[mix_hash(i) % count];
+        queries[i + 1] = queries[i];
+        ((uint8_t*)&queries[i + 1])[0] ^= 1;
+    }
+    return queries;
+}
+
+template <typename Key>
+static sgx_status_t check_into_bitmap(const SecretSet& set, const Key* numbers, size_t count,
+                                      uint8_t* bitmap);
+
+// Microseconds to check the calibration queries as one batch against the set
+// engine's index would make, through the path a real batch takes in the
+// selected batch mode: set_contains per query, contains_batch or
+// bulk_intersect
+template <typename Key>
+static sgx_status_t time_lookups(uint32_t engine, LookupIndex<Key>* index, const Key* values,
+                                 uint32_t count, const Key* queries, uint64_t* elapsed) {
+    // The set as install_set would publish it, owning nothing
+    SecretSet set{};
+    SetKeys<Key>& keys = keys_of<Key>(set);
+    set.key_type = KeyType<Key>::id;
+    set.count = count;
+    keys.values = (index && index->holds_values()) ? nullptr : const_cast<Key*>(values);
+    keys.index = index;
+    set.engine_report.engine = engine;
+
+    uint8_t bitmap[RESULT_BITMAP_BYTES(AUTO_CALIBRATION_LOOKUPS)] = {0};
+    uint64_t retval;
+    uint64_t start;
+    if (ocall_get_current_time(&retval, &start) != SGX_SUCCESS) {
+        return SGX_ERROR_UNEXPECTED;
+    }
+
+    sgx_status_t ret = check_into_bitmap(set, queries, AUTO_CALIBRATION_LOOKUPS, bitmap);
+
+    uint64_t end = start;
+    if (ocall_get_current_time(&retval, &end) != SGX_SUCCESS) {
+        ret = SGX_ERROR_UNEXPECTED;
+    }
+    memset(bitmap, 0, sizeof(bitmap));  // Secure cleanup
+    *elapsed = end - start;
+    return ret;
+}
+
+// Whether calibrated candidate a beats b: one that fits the memory budget
+// beats one that does not, the faster of two that fit wins, and the smaller
+// of two that do not
+static bool better_candidate(const EngineCalibration& a, const EngineCalibration& b) {
+    if (a.fits_budget != b.fits_budget) {
+        return a.fits_budget != 0;
+    }
+    return a.fits_budget ? a.lookup_ns < b.lookup_ns : a.memory_bytes < b.memory_bytes;
+}
+
+// LOOKUP_ENGINE_AUTO: builds and times each candidate engine in turn over
+// sorted values, keeping the best index so far into index, and records the
+// figures in report. The candidates follow from the set's shape: linear only
+// for sets small enough to scan, Elias-Fano only where the value range lets it
+// compress, and paged only if no engine that keeps the set in the enclave fits
+// the memory budget. The oblivious engine is a security choice, so it is never
+// picked for speed. Records the winner's build time.
+template <typename Key>
+static sgx_status_t select_lookup_engine(const Key* values, uint32_t count, bool keyed,
+                                         LookupIndex<Key>** index, EngineReport* report) {
+    *index = nullptr;
+    memset(report, 0, sizeof(*report));
+    Key* queries = calibration_queries(values, count);
+    if (!queries) {
+        return SGX_ERROR_OUT_OF_MEMORY;
+    }
+
+    uint32_t candidates[LOOKUP_ENGINE_COUNT];
+    uint32_t candidate_count = 0;
+    if (count <= AUTO_LINEAR_MAX_COUNT) {
+        candidates[candidate_count++] = LOOKUP_ENGINE_LINEAR;
+    }
+    candidates[candidate_count++] = LOOKUP_ENGINE_EYTZINGER;
+    candidates[candidate_count++] = LOOKUP_ENGINE_HASH;
+    uint64_t range = key_prefix(values[count - 1]) - key_prefix(values[0]);
+    if (elias_fano_compresses(range, count, sizeof(Key))) {
+        candidates[candidate_count++] = LOOKUP_ENGINE_ELIAS_FANO;
+    }
+
+    sgx_status_t ret = SGX_SUCCESS;
+    const EngineCalibration* best = nullptr;
+    for (uint32_t c = 0; c < candidate_count; c++) {
+        LookupIndex<Key>* candidate;
+        ret = build_lookup_index(candidates[c], values, count, &candidate);
+        if (ret == SGX_ERROR_OUT_OF_MEMORY) {
+            ret = SGX_SUCCESS;  // Does not fit at all; try the others
+        } else if (ret != SGX_SUCCESS) {
+            break;
+        } else {
+            EngineCalibration& calibration = report->candidates[report->candidate_count++];
+            calibration.engine = candidates[c];
+            calibration.build_time_us = g_timing.index_build_time;
+            calibration.memory_bytes = loaded_bytes(count, sizeof(Key), keyed, candidate);
+            calibration.fits_budget = (g_memory_budget == 0 ||
+                                       calibration.memory_bytes <= g_memory_budget);
+
+            uint64_t elapsed;
+            ret = time_lookups(candidates[c], candidate, values, count, queries, &elapsed);
+            if (ret != SGX_SUCCESS) {
+                delete candidate;
+                break;
+            }
+            calibration.lookup_ns = elapsed * 1000 / AUTO_CALIBRATION_LOOKUPS;
+
+            if (!best || better_candidate(calibration, *best)) {
+                delete *index;
+                *index = candidate;
+                best = &calibration;
+            } else {
+                delete candidate;
+            }
+        }
+
+        if (c + 1 == candidate_count && candidates[c] != LOOKUP_ENGINE_PAGED &&
+            (!best || !best->fits_budget)) {
+            candidates[candidate_count++] = LOOKUP_ENGINE_PAGED;
+        }
+    }
+
+    memset(queries, 0, AUTO_CALIBRATION_LOOKUPS * sizeof(Key));  // Secure cleanup
+    free(queries);
+    if (ret == SGX_SUCCESS && !best) {
+        ret = SGX_ERROR_OUT_OF_MEMORY;
+    }
+    if (ret != SGX_SUCCESS) {
+        delete *index;
+        *index = nullptr;
+        return ret;
+    }
+
+    report->engine = best->engine;
+    g_timing.index_build_time = best->build_time_us;
+    return SGX_SUCCESS;
+}
+
+// Builds the index for g_lookup_engine, choosing the engine first for
+// LOOKUP_ENGINE_AUTO, and records which engine it is in report
+template <typename Key>
+static sgx_status_t build_set_index(const Key* values, uint32_t count, bool keyed,
+                                    LookupIndex<Key>** index, EngineReport* report) {
+    if (g_lookup_engine == LOOKUP_ENGINE_AUTO) {
+        return select_lookup_engine(values, count, keyed, index, report);
+    }
+
+    memset(report, 0, sizeof(*report));
+    report->engine = g_lookup_engine;
+    return build_lookup_index(g_lookup_engine, values, count, index);
+}
+
+// Whether value is in the set as loaded, ignoring pending updates
+template <typename Key>
+static bool base_contains(const SecretSet& set, Key value) {
+    const SetKeys<Key>& keys = keys_of<Key>(set);
+    if (keys.index) {
+        return keys.index->contains(value);
+    }
+    return std::binary_search(keys.values, keys.values + set.count, value);
+}
+
+// Corrects a lookup against the set as loaded for its pending updates. Under
+// the oblivious engine both pending sets are scanned in full and the answers
+// combined without branching; deletes only hold values in the set as loaded
+// and inserts only values outside it.
+template <typename Key>
+static inline int apply_delta(const SecretSet& set, Key value, int in_base) {
+    const SetKeys<Key>& keys = keys_of<Key>(set);
+    if (set.engine_report.engine == LOOKUP_ENGINE_OBLIVIOUS) {
+        int deleted = keys.deletes.scan_contains(value) ? 1 : 0;
+        int inserted = keys.inserts.scan_contains(value) ? 1 : 0;
+        return (in_base & (deleted ^ 1)) | inserted;
+    }
+    if (in_base) {
+        return (keys.deletes.size() == 0 || !keys.deletes.contains(value)) ? 1 : 0;
+    }
+    return (keys.inserts.size() != 0 && keys.inserts.contains(value)) ? 1 : 0;
+}
+
+// Applies a batch of updates: a value whose opposite update is pending
+// cancels it, any other value is recorded only if it changes the set as
+// loaded. Sorts values in place; costs O(count log(set + delta) + delta).
+// Changes nothing if the set would end up empty or over MAX_VALUES.
+template <typename Key>
+static sgx_status_t apply_update(SecretSet& set, uint32_t op, Key* values, uint32_t count) {
+    std::sort(values, values + count);
+    count = (uint32_t)(std::unique(values, values + count) - values);
+
+    SetKeys<Key>& keys = keys_of<Key>(set);
+    DeltaSet<Key>& pending = (op == UPDATE_INSERT) ? keys.inserts : keys.deletes;
+    DeltaSet<Key>& opposite = (op == UPDATE_INSERT) ? keys.deletes : keys.inserts;
+    bool changes_when_in_base = (op == UPDATE_DELETE);
+
+    Key* cancelled = (Key*)malloc((size_t)count * sizeof(Key));
+    if (!cancelled) {
+        return SGX_ERROR_OUT_OF_MEMORY;
+    }
+
+    // Recorded values are compacted to the front of values, keeping the order
+    uint32_t recorded_count = 0;
+    uint32_t cancelled_count = 0;
+    for (uint32_t i = 0; i < count; i++) {
+        Key value = values[i];
+        if (opposite.contains(value)) {
+            cancelled[cancelled_count++] = value;
+        } else if (base_contains(set, value) == changes_when_in_base && !pending.contains(value)) {
+            values[recorded_count++] = value;
+        }
+    }
+
+    // Compaction has to be able to fold the updates into a set that loads,
+    // so none may take the set outside 1 to MAX_VALUES values
+    int64_t change = (int64_t)recorded_count + cancelled_count;
+    int64_t after = (int64_t)set.count + keys.inserts.size() - keys.deletes.size() +
+                    (op == UPDATE_INSERT ? change : -change);
+
+    sgx_status_t ret = SGX_ERROR_INVALID_PARAMETER;
+    if (after >= 1 && after <= MAX_VALUES) {
+        ret = SGX_ERROR_OUT_OF_MEMORY;
+        if (pending.insert_sorted(values, recorded_count)) {
+            opposite.erase_sorted(cancelled, cancelled_count);
+            ret = SGX_SUCCESS;
+        }
+    }
+
+    memset(cancelled, 0, (size_t)count * sizeof(Key));  // Secure cleanup
+    free(cancelled);
+    return ret;
+}
+
+// Looks up number in the set, pending updates included. The linear engine
+// scans with page fault tracking, tallied locally so concurrent callers touch
+// the shared counter once per lookup.
+template <typename Key>
+static int set_contains(const SecretSet& set, Key number) {
+    const SetKeys<Key>& keys = keys_of<Key>(set);
+    if (keys.index) {
+        return apply_delta(set, number, keys.index->contains(number) ? 1 : 0);
+    }
+
+    uint64_t page_faults = 0;
+    int result = 0;
+    for (uint32_t i = 0; i < set.count; i++) {
+        // Track page faults and ensure memory access is within enclave
+        if (sgx_is_within_enclave(&keys.values[i], sizeof(Key))) {
+            page_faults++;
+        }
+
+        // Cache-friendly comparison
+        Key current_value = keys.values[i];
+        if (current_value == number) {
+            result = 1;  // Match found
+            break;
+        }
+    }
+
+    g_page_fault_count.fetch_add(page_faults, std::memory_order_relaxed);
+    return apply_delta(set, number, result);
+}
+
+sgx_status_t ecall_initialize_aes_key(const uint8_t* key_data, size_t key_size) {
+    if (!key_data || key_size != (AES_KEY_SIZE + AES_BLOCK_SIZE)) {
+        return SGX_ERROR_INVALID_PARAMETER;
+    }
+
+    // Ensure proper alignment of key data
+    memcpy(g_aes_key, key_data, AES_KEY_SIZE);
+    memcpy(g_aes_counter, key_data + AES_KEY_SIZE, AES_BLOCK_SIZE);
+    g_aes_initialized = true;
+
+    return SGX_SUCCESS;
+}
+
+// Stages count values of key_type for set_id; a keyed set also takes count
+// payloads through ecall_append_secret_payloads
+static sgx_status_t begin_ingest(uint32_t set_id, uint32_t key_type, uint32_t count,
+                                 uint32_t keyed) {
+    if (key_type >= KEY_TYPE_COUNT || count == 0 || count > MAX_VALUES || keyed > 1) {
+        return SGX_ERROR_INVALID_PARAMETER;
+    }
+
+    // Only count entries are reserved and nothing is evicted: the values are
+    // not validated yet, so every loaded set, including one under set_id,
+    // stays in service until commit makes room for the set as built
+    release_ingest();
+    size_t values_size = (size_t)count * KEY_TYPE_SIZE(key_type);
+    size_t payloads_size = keyed ? (size_t)count * PAYLOAD_SIZE : 0;
+    if (g_memory_budget != 0 && values_size + payloads_size > g_memory_budget) {
+        return SGX_ERROR_OUT_OF_MEMORY;
+    }
+
+    g_ingest_values = (uint8_t*)aligned_malloc(values_size, 16);
+    if (!g_ingest_values) {
+        return SGX_ERROR_OUT_OF_MEMORY;
+    }
+
+    if (keyed) {
+        g_ingest_payloads = (uint32_t*)aligned_malloc(payloads_size, 16);
+        if (!g_ingest_payloads) {
+            release_ingest();
+            return SGX_ERROR_OUT_OF_MEMORY;
+        }
+    }
+
+    g_ingest_set_id = set_id;
+    g_ingest_key_type = key_type;
+    g_ingest_count = count;
+    return SGX_SUCCESS;
+}
+
+sgx_status_t ecall_begin_secret_data(uint32_t set_id, uint32_t key_type, uint32_t count,
+                                     uint32_t keyed) {
+    IngestSection section;
+    return section.held() ? begin_ingest(set_id, key_type, count, keyed) : SGX_ERROR_BUSY;
+}
+
+// Takes whole values of the key type given to ecall_begin_secret_data
+static sgx_status_t append_values(const uint8_t* values, size_t size) {
+    size_t key_size = KEY_TYPE_SIZE(g_ingest_key_type);
+    if (!g_ingest_values || g_shard_count != 0 || !values || size % key_size != 0 ||
+        size / key_size > g_ingest_count - g_ingest_filled) {
+        return SGX_ERROR_INVALID_PARAMETER;
+    }
+
+    memcpy(g_ingest_values + (size_t)g_ingest_filled * key_size, values, size);
+    g_ingest_filled += (uint32_t)(size / key_size);
+    return SGX_SUCCESS;
+}
+
+sgx_status_t ecall_append_secret_data(const uint8_t* values, size_t size) {
+    IngestSection section;
+    return section.held() ? append_values(values, size) : SGX_ERROR_BUSY;
+}
+
+// Takes the payloads of a keyed set in the order of its values as appended
+static sgx_status_t append_payloads(const uint8_t* payloads, size_t size) {
+    if (!g_ingest_payloads || !payloads || size % PAYLOAD_SIZE != 0 ||
+        size / PAYLOAD_SIZE > g_ingest_count - g_ingest_payloads_filled) {
+        return SGX_ERROR_INVALID_PARAMETER;
+    }
+
+    memcpy(g_ingest_payloads + g_ingest_payloads_filled, payloads, size);
+    g_ingest_payloads_filled += (uint32_t)(size / PAYLOAD_SIZE);
+    return SGX_SUCCESS;
+}
+
+sgx_status_t ecall_append_secret_payloads(const uint8_t* payloads, size_t size) {
+    IngestSection section;
+    return section.held() ? append_payloads(payloads, size) : SGX_ERROR_BUSY;
+}
+
+// Sorts count values together with their payloads through a permutation
+template <typename Key>
+static bool sort_keyed_values(Key* values, uint32_t* payloads, uint32_t count) {
+    uint32_t* order = (uint32_t*)malloc((size_t)count * sizeof(uint32_t));
+    Key* sorted = (Key*)aligned_malloc((size_t)count * sizeof(Key), 16);
+    uint32_t* sorted_payloads = (uint32_t*)malloc((size_t)count * PAYLOAD_SIZE);
+    bool ok = order && sorted && sorted_payloads;
+    if (ok) {
+        for (uint32_t i = 0; i < count; i++) {
+            order[i] = i;
+        }
+        std::sort(order, order + count, [values](uint32_t a, uint32_t b) {
+            return values[a] < values[b];
+        });
+        for (uint32_t i = 0; i < count; i++) {
+            sorted[i] = values[order[i]];
+            sorted_payloads[i] = payloads[order[i]];
+        }
+        memcpy(values, sorted, (size_t)count * sizeof(Key));
+        memcpy(payloads, sorted_payloads, (size_t)count * PAYLOAD_SIZE);
+    }
+
+    free_values(order, count);
+    free_values(sorted, count);
+    free_values(sorted_payloads, count);
+    return ok;
+}
+
+template <typename Key>
+static sgx_status_t commit_ingest() {
+    // A freshly loaded set starts a delta log no earlier record applies to
+    uint64_t generation;
+    sgx_status_t ret = sgx_read_rand((unsigned char*)&generation, sizeof(generation));
+    if (ret != SGX_SUCCESS) {
+        return ret;
+    }
+
+    // The search indexes need ascending input; value_sealer already sorts,
+    // but the file comes from untrusted storage. Payloads move with their
+    // values, and a value keyed twice has no single payload to return.
+    Key* values = (Key*)g_ingest_values;
+    Key* values_end = values + g_ingest_count;
+    if (!std::is_sorted(values, values_end)) {
+        if (!g_ingest_payloads) {
+            std::sort(values, values_end);
+        } else if (!sort_keyed_values(values, g_ingest_payloads, g_ingest_count)) {
+            release_ingest();
+            return SGX_ERROR_OUT_OF_MEMORY;
+        }
+    }
+    if (g_ingest_payloads && std::adjacent_find(values, values_end) != values_end) {
+        release_ingest();
+        return SGX_ERROR_INVALID_PARAMETER;
+    }
+
+    LookupIndex<Key>* index;
+    EngineReport report;
+    ret = build_set_index(values, g_ingest_count, g_ingest_payloads != nullptr, &index, &report);
+    if (ret != SGX_SUCCESS) {
+        release_ingest();
+        return ret;
+    }
+
+    std::atomic<SecretSet*>* slot =
+        make_room(g_ingest_set_id,
+                  loaded_bytes(g_ingest_count, sizeof(Key), g_ingest_payloads != nullptr, index));
+    if (!slot) {
+        delete index;
+        release_ingest();
+        return SGX_ERROR_OUT_OF_MEMORY;
+    }
+
+    ret = install_set(*slot, g_ingest_set_id, values, g_ingest_payloads, g_ingest_count, index,
+                      report, generation);
+    g_ingest_values = nullptr;
+    g_ingest_payloads = nullptr;
+    g_ingest_count = 0;
+    g_ingest_filled = 0;
+    g_ingest_payloads_filled = 0;
+    g_page_fault_count = 0;  // Reset page fault counter
+
+    return ret;
+}
+
+// Loads the values staged through ecall_begin/append_secret_data
+static sgx_status_t commit_appended() {
+    if (!g_ingest_values || g_shard_count != 0 || g_ingest_filled != g_ingest_count ||
+        (g_ingest_payloads && g_ingest_payloads_filled != g_ingest_count)) {
+        return SGX_ERROR_INVALID_PARAMETER;
+    }
+
+    return DISPATCH_KEY_TYPE(g_ingest_key_type, commit_ingest, ());
+}
+
+sgx_status_t ecall_commit_secret_data() {
+    IngestSection section;
+    return section.held() ? commit_appended() : SGX_ERROR_BUSY;
+}
+
+// Ingests a secret set file the host has mapped into untrusted memory. The
+// values are copied once, straight into the array the index is built from;
+// the header is fetched once so the host cannot change it after validation.
+sgx_status_t ecall_ingest_secret_file(uint32_t set_id, const uint8_t* file, size_t file_size) {
+    if (!file || file_size < SECRET_DATA_HEADER_SIZE ||
+        !sgx_is_outside_enclave(file, file_size)) {
+        return SGX_ERROR_INVALID_PARAMETER;
+    }
+
+    SecretDataHeader header;
+    memcpy(&header, file, SECRET_DATA_HEADER_SIZE);
+    bool keyed = (header.version == SECRET_DATA_VERSION_KEYED);
+    if (header.version != CURRENT_VERSION && !keyed) {
+        return SGX_ERROR_INVALID_VERSION;
+    }
+
+    if (header.key_type >= KEY_TYPE_COUNT || header.count == 0 || header.count > MAX_VALUES) {
+        return SGX_ERROR_UNEXPECTED;
+    }
+
+    size_t values_end = SECRET_DATA_SIZE(header.count, header.key_type);
+    if (file_size < (keyed ? KEYED_SECRET_DATA_SIZE(header.count, header.key_type) : values_end)) {
+        return SGX_ERROR_INVALID_PARAMETER;
+    }
+
+    IngestSection section;
+    if (!section.held()) {
+        return SGX_ERROR_BUSY;
+    }
+
+    sgx_status_t ret = begin_ingest(set_id, header.key_type, header.count, keyed);
+    if (ret == SGX_SUCCESS) {
+        ret = append_values(file + SECRET_DATA_HEADER_SIZE,
+                            (size_t)header.count * KEY_TYPE_SIZE(header.key_type));
+    }
+    if (ret == SGX_SUCCESS && keyed) {
+        ret = append_payloads(file + values_end, (size_t)header.count * PAYLOAD_SIZE);
+    }
+    if (ret == SGX_SUCCESS) {
+        ret = commit_appended();
+    }
+
+    release_ingest();
+    return ret;
+}
+
+// Loads a whole 32-bit SecretData image in one call. Only the header and the
+// first count values have to be present.
+sgx_status_t ecall_initialize_secret_data(uint32_t set_id, const uint8_t* sealed_data,
+                                          size_t sealed_size) {
+    if (!sealed_data || sealed_size < SECRET_DATA_HEADER_SIZE) {
+        return SGX_ERROR_INVALID_PARAMETER;
+    }
+
+    const SecretData* secret_data = (const SecretData*)sealed_data;
+    if (secret_data->version != CURRENT_VERSION) {
+        return SGX_ERROR_INVALID_VERSION;
+    }
+
+    if (secret_data->count == 0 || secret_data->count > MAX_VALUES) {
+        return SGX_ERROR_UNEXPECTED;
+    }
+
+    if (sealed_size < SECRET_DATA_SIZE(secret_data->count, KEY_TYPE_INT32)) {
+        return SGX_ERROR_INVALID_PARAMETER;
+    }
+
+    IngestSection section;
+    if (!section.held()) {
+        return SGX_ERROR_BUSY;
+    }
+
+    sgx_status_t ret = begin_ingest(set_id, KEY_TYPE_INT32, secret_data->count, 0);
+    if (ret == SGX_SUCCESS) {
+        ret = append_values((const uint8_t*)secret_data->values,
+                            (size_t)secret_data->count * sizeof(int));
+    }
+    if (ret == SGX_SUCCESS) {
+        ret = commit_appended();
+    }
+
+    release_ingest();
+    return ret;
+}
+
+// Reserves a set of shard_count shards of key_type, shard i holding
+// shard_counts[i] values, for ecall_ingest_secret_shard to fill in any order.
+// As with ecall_begin_secret_data, nothing is evicted until commit; the merge
+// needs as much memory again as the staged values until it completes.
+sgx_status_t ecall_begin_secret_shards(uint32_t set_id, uint32_t key_type,
+                                       const uint32_t* shard_counts, uint32_t shard_count) {
+    if (!shard_counts || shard_count == 0 || shard_count > MAX_SECRET_SHARDS) {
+        return SGX_ERROR_INVALID_PARAMETER;
+    }
+
+    uint64_t total = 0;
+    for (uint32_t i = 0; i < shard_count; i++) {
+        if (shard_counts[i] == 0) {
+            return SGX_ERROR_INVALID_PARAMETER;
+        }
+        total += shard_counts[i];
+    }
+    if (total > MAX_VALUES) {
+        return SGX_ERROR_INVALID_PARAMETER;
+    }
+
+    IngestSection section;
+    if (!section.held()) {
+        return SGX_ERROR_BUSY;
+    }
+
+    sgx_status_t ret = begin_ingest(set_id, key_type, (uint32_t)total, 0);
+    if (ret != SGX_SUCCESS) {
+        return ret;
+    }
+
+    g_shard_offsets[0] = 0;
+    for (uint32_t i = 0; i < shard_count; i++) {
+        g_shard_offsets[i + 1] = g_shard_offsets[i] + shard_counts[i];
+    }
+    g_shard_count = shard_count;
+    return SGX_SUCCESS;
+}
+
+// Sorts a shard that arrived out of order, so the merge can rely on every
+// shard being sorted
+template <typename Key>
+static void sort_shard(uint8_t* values, uint32_t count) {
+    Key* begin = (Key*)values;
+    if (!std::is_sorted(begin, begin + count)) {
+        std::sort(begin, begin + count);
+    }
+}
+
+// Copies one shard out of a shard file the host has mapped into untrusted
+// memory. Each shard is taken once; the values are copied before they are
+// checked, so the host cannot change them afterwards.
+static sgx_status_t ingest_shard(uint32_t shard, const uint8_t* file, size_t file_size) {
+    if (shard >= g_shard_count || !file || file_size < SECRET_DATA_HEADER_SIZE ||
+        !sgx_is_outside_enclave(file, file_size)) {
+        return SGX_ERROR_INVALID_PARAMETER;
+    }
+
+    SecretDataHeader header;
+    memcpy(&header, file, SECRET_DATA_HEADER_SIZE);
+    if (header.version != CURRENT_VERSION) {
+        return SGX_ERROR_INVALID_VERSION;  // Keyed sets cannot be sharded
+    }
+
+    uint32_t count = g_shard_offsets[shard + 1] - g_shard_offsets[shard];
+    if (header.key_type != g_ingest_key_type || header.count != count ||
+        file_size < SECRET_DATA_SIZE(count, header.key_type)) {
+        return SGX_ERROR_INVALID_PARAMETER;
+    }
+
+    if (g_shard_claimed[shard].exchange(1) != 0) {
+        return SGX_ERROR_INVALID_STATE;
+    }
+
+    size_t key_size = KEY_TYPE_SIZE(g_ingest_key_type);
+    uint8_t* values = g_ingest_values + (size_t)g_shard_offsets[shard] * key_size;
+    memcpy(values, file + SECRET_DATA_HEADER_SIZE, (size_t)count * key_size);
+    DISPATCH_KEY_TYPE(g_ingest_key_type, sort_shard, (values, count));
+    g_shards_filled.fetch_add(1);
+    return SGX_SUCCESS;
+}
+
+// Shard ingests run concurrently with each other; each counts itself in
+// before it reads the staging state and out once its copy is done, and is
+// refused while an IngestSection is held
+sgx_status_t ecall_ingest_secret_shard(uint32_t shard, const uint8_t* file, size_t file_size) {
+    if (g_ingest_users.fetch_add(1) & INGEST_CLOSED) {
+        g_ingest_users.fetch_sub(1);
+        return SGX_ERROR_BUSY;
+    }
+
+    sgx_status_t ret = ingest_shard(shard, file, file_size);
+    g_ingest_users.fetch_sub(1);
+    return ret;
+}
+
+// Merges the staged shards into one sorted array, keeping a single copy of a
+// value found in several of them or repeated within one, and commits that in
+// their place. A heap of the shards, ordered by their next value, yields each
+// value in log2(shards) compares, so the merge is one pass over the values.
+template <typename Key>
+static sgx_status_t commit_shards() {
+    const Key* staged = (const Key*)g_ingest_values;
+    Key* merged = (Key*)aligned_malloc((size_t)g_ingest_count * sizeof(Key), 16);
+    if (!merged) {
+        release_ingest();
+        return SGX_ERROR_OUT_OF_MEMORY;
+    }
+
+    uint32_t next[MAX_SECRET_SHARDS];  // Next staged value of each shard
+    uint32_t heap[MAX_SECRET_SHARDS];  // Shards with values left
+    uint32_t heap_size = g_shard_count;
+    for (uint32_t i = 0; i < g_shard_count; i++) {
+        next[i] = g_shard_offsets[i];
+        heap[i] = i;
+    }
+    auto later = [&](uint32_t a, uint32_t b) { return staged[next[b]] < staged[next[a]]; };
+    std::make_heap(heap, heap + heap_size, later);
+
+    uint32_t count = 0;
+    while (heap_size > 0) {
+        std::pop_heap(heap, heap + heap_size, later);
+        uint32_t shard = heap[heap_size - 1];
+        Key value = staged[next[shard]++];
+        if (count == 0 || merged[count - 1] != value) {
+            merged[count++] = value;
+        }
+
+        if (next[shard] == g_shard_offsets[shard + 1]) {
+            heap_size--;
+        } else {
+            std::push_heap(heap, heap + heap_size, later);
+        }
+    }
+
+    free_values(g_ingest_values, g_ingest_count * (uint32_t)sizeof(Key));
+    g_ingest_values = (uint8_t*)merged;
+    g_ingest_count = count;
+    g_ingest_filled = count;
+    return commit_ingest<Key>();
+}
+
+// Merges the shards once every one has been ingested and loads the result
+// under the set id given to ecall_begin_secret_shards
+sgx_status_t ecall_commit_secret_shards() {
+    IngestSection section;
+    if (!section.held()) {
+        return SGX_ERROR_BUSY;
+    }
+    if (g_shard_count == 0 || g_shards_filled != g_shard_count) {
+        return SGX_ERROR_INVALID_PARAMETER;
+    }
+
+    sgx_status_t ret = DISPATCH_KEY_TYPE(g_ingest_key_type, commit_shards, ());
+    release_ingest();
+    return ret;
+}
+
+// Drops whatever ingest, shard ingest or snapshot import was begun and not
+// committed, for a host that gives up on it partway
+sgx_status_t ecall_abort_secret_ingest() {
+    IngestSection section;
+    if (!section.held()) {
+        return SGX_ERROR_BUSY;
+    }
+
+    release_snapshot_import();
+    return SGX_SUCCESS;
+}
+
+static inline uint32_t snapshot_chunks(uint64_t bytes) {
+    return (uint32_t)((bytes + SNAPSHOT_CHUNK_BYTES - 1) / SNAPSHOT_CHUNK_BYTES);
+}
+
+// Fills in chunk_count for a snapshot of count values, their payloads if
+// keyed and index_bytes of index
+static void set_snapshot_chunk_count(IndexSnapshotHeader& header) {
+    uint64_t values_bytes = (uint64_t)header.count * KEY_TYPE_SIZE(header.key_type);
+    uint64_t payload_bytes = header.keyed ? (uint64_t)header.count * PAYLOAD_SIZE : 0;
+    header.chunk_count = snapshot_chunks(values_bytes) + snapshot_chunks(payload_bytes) +
+                         snapshot_chunks(header.index_bytes);
+}
+
+// Locates a snapshot chunk in its final home: the first chunks cover values,
+// then the payloads of a keyed set, the rest cover the index storage, so each
+// seals from and unseals into place. Returns nullptr for a values chunk when
+// values is nullptr.
+static uint8_t* snapshot_chunk(const IndexSnapshotHeader& header, uint32_t chunk,
+                               uint8_t* values, uint32_t* payloads, LookupIndexStorage* index,
+                               uint32_t* size) {
+    uint64_t values_bytes = (uint64_t)header.count * KEY_TYPE_SIZE(header.key_type);
+    uint64_t payload_bytes = header.keyed ? (uint64_t)header.count * PAYLOAD_SIZE : 0;
+    uint32_t value_chunks = snapshot_chunks(values_bytes);
+    uint32_t payload_chunks = snapshot_chunks(payload_bytes);
+
+    uint8_t* base = values;
+    uint64_t region_bytes = values_bytes;
+    if (chunk >= value_chunks + payload_chunks) {
+        base = (uint8_t*)index->storage();
+        region_bytes = header.index_bytes;
+        chunk -= value_chunks + payload_chunks;
+    } else if (chunk >= value_chunks) {
+        base = (uint8_t*)payloads;
+        region_bytes = payload_bytes;
+        chunk -= value_chunks;
+    }
+
+    uint64_t offset = (uint64_t)chunk * SNAPSHOT_CHUNK_BYTES;
+    uint64_t remaining = region_bytes - offset;
+    *size = (uint32_t)(remaining < SNAPSHOT_CHUNK_BYTES ? remaining : SNAPSHOT_CHUNK_BYTES);
+    return base ? base + offset : nullptr;
+}
+
+template <typename Key>
+static sgx_status_t export_snapshot_chunk(const SecretSet& set, uint32_t chunk, uint8_t* sealed_chunk,
+                                          size_t buffer_size, uint32_t* sealed_size,
+                                          uint32_t* chunk_count) {
+    const SetKeys<Key>& keys = keys_of<Key>(set);
+
+    IndexSnapshotHeader header;
+    memset(&header, 0, sizeof(header));
+    header.magic = SNAPSHOT_MAGIC;
+    header.version = CURRENT_VERSION;
+    header.engine = keys.index ? set.engine_report.engine : LOOKUP_ENGINE_LINEAR;
+    header.count = set.count;
+    header.index_bytes = (keys.index && keys.index->storage()) ? keys.index->memory_bytes() : 0;
+    header.chunk = chunk;
+    header.generation = set.generation;
+    header.key_type = set.key_type;
+    header.keyed = (set.payloads != nullptr);
+    header.snapshot_id = set.snapshot_id;
+    set_snapshot_chunk_count(header);
+    if (chunk >= header.chunk_count) {
+        return SGX_ERROR_INVALID_PARAMETER;
+    }
+
+    uint32_t size;
+    const uint8_t* data = snapshot_chunk(header, chunk, (uint8_t*)keys.values, set.payloads,
+                                         keys.index, &size);
+    uint32_t needed = sgx_calc_sealed_data_size(sizeof(header), size);
+    if (needed == UINT32_MAX || needed > buffer_size) {
+        return SGX_ERROR_INVALID_PARAMETER;
+    }
+
+    // Values the index holds are read back into a scratch chunk to be sealed
+    Key* scratch = nullptr;
+    if (!data) {
+        uint32_t first = (uint32_t)((uint64_t)chunk * SNAPSHOT_CHUNK_BYTES / sizeof(Key));
+        scratch = (Key*)malloc(size);
+        if (!scratch) {
+            return SGX_ERROR_OUT_OF_MEMORY;
+        }
+        if (!read_set_values(set, first, size / sizeof(Key), scratch)) {
+            free(scratch);
+            return SGX_ERROR_UNEXPECTED;
+        }
+        data = (const uint8_t*)scratch;
+    }
+
+    sgx_status_t ret = sgx_seal_data(sizeof(header), (const uint8_t*)&header, size, data,
+                                     needed, (sgx_sealed_data_t*)sealed_chunk);
+    if (scratch) {
+        memset(scratch, 0, size);  // Secure cleanup
+        free(scratch);
+    }
+    if (ret != SGX_SUCCESS) {
+        return ret;
+    }
+
+    *sealed_size = needed;
+    *chunk_count = header.chunk_count;
+    return SGX_SUCCESS;
+}
+
+// The snapshot covers the set as loaded; pending updates stay in the delta
+// log of the generation it records
+sgx_status_t ecall_export_index_snapshot(uint32_t set_id, uint32_t chunk, uint8_t* sealed_chunk,
+                                         size_t buffer_size, uint32_t* sealed_size,
+                                         uint32_t* chunk_count) {
+    ReadSection reading;
+    SecretSet* set = find_set(set_id);
+    if (!sealed_chunk || !sealed_size || !chunk_count) {
+        return SGX_ERROR_INVALID_PARAMETER;
+    }
+    if (!set) {
+        return SGX_ERROR_INVALID_STATE;
+    }
+
+    return DISPATCH_KEY_TYPE(set->key_type, export_snapshot_chunk,
+                             (*set, chunk, sealed_chunk, buffer_size, sealed_size, chunk_count));
+}
+
+// allocate_lookup_index for a snapshot whose key type is known only at run time
+template <typename Key>
+static LookupIndexStorage* allocate_snapshot_index(uint32_t engine, uint32_t count) {
+    return allocate_lookup_index<Key>(engine, count);
+}
+
+// Loads the fully imported snapshot under g_snapshot_set_id
+template <typename Key>
+static sgx_status_t install_snapshot() {
+    Key* values = (Key*)g_ingest_values;
+    LookupIndex<Key>* index = static_cast<LookupIndex<Key>*>(g_snapshot_index);
+
+    EngineReport report;
+    memset(&report, 0, sizeof(report));
+    report.engine = g_snapshot_header.engine;
+
+    g_timing.index_build_time = 0;
+    if (g_snapshot_header.engine != LOOKUP_ENGINE_LINEAR && !index) {
+        sgx_status_t ret = build_lookup_index(g_snapshot_header.engine, values, g_ingest_count,
+                                              &index);
+        if (ret != SGX_SUCCESS) {
+            release_snapshot_import();
+            return ret;
+        }
+        g_snapshot_index = index;
+    }
+
+    std::atomic<SecretSet*>* slot =
+        make_room(g_snapshot_set_id,
+                  loaded_bytes(g_ingest_count, sizeof(Key), g_ingest_payloads != nullptr, index));
+    if (!slot) {
+        release_snapshot_import();
+        return SGX_ERROR_OUT_OF_MEMORY;
+    }
+
+    sgx_status_t ret = install_set(*slot, g_snapshot_set_id, values, g_ingest_payloads,
+                                   g_ingest_count, index, report, g_snapshot_header.generation);
+    g_ingest_values = nullptr;
+    g_ingest_payloads = nullptr;
+    g_ingest_count = 0;
+    g_ingest_filled = 0;
+    g_snapshot_index = nullptr;
+    g_snapshot_next_chunk = 0;
+    g_page_fault_count = 0;
+    return ret;
+}
+
+// Chunks must arrive in order starting at 0; the last one, reported by
+// chunks_left dropping to 0, loads the restored set and index under set_id
+// without sorting anything. Only an index without storage is built.
+sgx_status_t ecall_import_index_snapshot(uint32_t set_id, uint32_t chunk, const uint8_t* sealed_chunk,
+                                         size_t sealed_size, uint32_t* chunks_left) {
+    IngestSection section;
+    if (!section.held()) {
+        return SGX_ERROR_BUSY;
+    }
+    if (!sealed_chunk || !chunks_left || sealed_size < sizeof(sgx_sealed_data_t) ||
+        (chunk != 0 && (chunk != g_snapshot_next_chunk || set_id != g_snapshot_set_id))) {
+        return SGX_ERROR_INVALID_PARAMETER;
+    }
+
+    const sgx_sealed_data_t* sealed = (const sgx_sealed_data_t*)sealed_chunk;
+    uint32_t text_size = sgx_get_encrypt_txt_len(sealed);
+    if (sgx_get_add_mac_txt_len(sealed) != sizeof(IndexSnapshotHeader) ||
+        text_size == 0 || text_size > SNAPSHOT_CHUNK_BYTES ||
+        sgx_calc_sealed_data_size(sizeof(IndexSnapshotHeader), text_size) != sealed_size) {
+        return SGX_ERROR_INVALID_PARAMETER;
+    }
+
+    IndexSnapshotHeader header;
+    uint32_t header_size = sizeof(header);
+    uint32_t unsealed_size = text_size;
+    sgx_status_t ret;
+
+    if (chunk == 0) {
+        // Nothing is known about the set until the first chunk is authenticated
+        release_snapshot_import();
+        uint8_t* first = (uint8_t*)malloc(text_size);
+        if (!first) {
+            return SGX_ERROR_OUT_OF_MEMORY;
+        }
+
+        ret = sgx_unseal_data(sealed, (uint8_t*)&header, &header_size, first, &unsealed_size);
+
+        // Recomputing the chunk count rejects headers with inconsistent sizes
+        IndexSnapshotHeader expected = header;
+        set_snapshot_chunk_count(expected);
+        if (ret == SGX_SUCCESS &&
+            (header.magic != SNAPSHOT_MAGIC || header.version != CURRENT_VERSION ||
+             header.chunk != 0 || header.chunk_count != expected.chunk_count ||
+             (header.engine != g_lookup_engine && g_lookup_engine != LOOKUP_ENGINE_AUTO) ||
+             header.engine >= LOOKUP_ENGINE_COUNT || header.key_type >= KEY_TYPE_COUNT ||
+             header.keyed > 1)) {
+            ret = SGX_ERROR_INVALID_PARAMETER;
+        }
+
+        if (ret == SGX_SUCCESS) {
+            ret = begin_ingest(set_id, header.key_type, header.count, header.keyed);
+        }
+
+        if (ret == SGX_SUCCESS && header.index_bytes != 0) {
+            g_snapshot_index = DISPATCH_KEY_TYPE(header.key_type, allocate_snapshot_index,
+                                                 (header.engine, header.count));
+            if (!g_snapshot_index) {
+                ret = SGX_ERROR_OUT_OF_MEMORY;
+            }
+        }
+
+        uint64_t index_bytes = g_snapshot_index ? g_snapshot_index->memory_bytes() : 0;
+        if (ret == SGX_SUCCESS && header.index_bytes != index_bytes) {
+            ret = SGX_ERROR_INVALID_PARAMETER;
+        }
+
+        if (ret == SGX_SUCCESS) {
+            uint32_t size;
+            uint8_t* dst = snapshot_chunk(header, 0, g_ingest_values, g_ingest_payloads,
+                                          g_snapshot_index, &size);
+            if (size == unsealed_size) {
+                memcpy(dst, first, size);
+            } else {
+                ret = SGX_ERROR_INVALID_PARAMETER;
+            }
+        }
+
+        memset(first, 0, text_size);  // Secure cleanup
+        free(first);
+        if (ret == SGX_SUCCESS) {
+            g_snapshot_header = header;
+            g_snapshot_set_id = set_id;
+        }
+    } else {
+        // Later chunks unseal straight into place once their size matches
+        uint32_t size;
+        uint8_t* dst = snapshot_chunk(g_snapshot_header, chunk, g_ingest_values,
+                                      g_ingest_payloads, g_snapshot_index, &size);
+        ret = (size == text_size) ? SGX_SUCCESS : SGX_ERROR_INVALID_PARAMETER;
+        if (ret == SGX_SUCCESS) {
+            ret = sgx_unseal_data(sealed, (uint8_t*)&header, &header_size, dst, &unsealed_size);
+        }
+
+        if (ret == SGX_SUCCESS &&
+            (header.magic != g_snapshot_header.magic || header.version != g_snapshot_header.version ||
+             header.engine != g_snapshot_header.engine || header.count != g_snapshot_header.count ||
+             header.index_bytes != g_snapshot_header.index_bytes ||
+             header.chunk_count != g_snapshot_header.chunk_count ||
+             header.generation != g_snapshot_header.generation ||
+             header.key_type != g_snapshot_header.key_type ||
+             header.keyed != g_snapshot_header.keyed ||
+             header.snapshot_id != g_snapshot_header.snapshot_id || header.chunk != chunk)) {
+            ret = SGX_ERROR_INVALID_PARAMETER;
+        }
+    }
+
+    if (ret != SGX_SUCCESS) {
+        release_snapshot_import();
+        return ret;
+    }
+
+    g_snapshot_next_chunk = chunk + 1;
+    *chunks_left = g_snapshot_header.chunk_count - g_snapshot_next_chunk;
+    if (*chunks_left > 0) {
+        return SGX_SUCCESS;
+    }
+
+    // Every chunk is in; swap the restored set and index in
+    return DISPATCH_KEY_TYPE(g_snapshot_header.key_type, install_snapshot, ());
+}
+
+// Rebuilds a set's index for g_lookup_engine, first reading the values back
+// into the enclave if the old index holds them. LOOKUP_ENGINE_AUTO calibrates
+// the set afresh.
+template <typename Key>
+static sgx_status_t rebuild_set_index(SecretSet& set) {
+    SetKeys<Key>& keys = keys_of<Key>(set);
+    if (!keys.values) {
+        keys.values = copy_set_values<Key>(set);
+        if (!keys.values) {
+            return SGX_ERROR_OUT_OF_MEMORY;
+        }
+    }
+
+    delete keys.index;
+    sgx_status_t ret = build_set_index(keys.values, set.count, set.payloads != nullptr, &keys.index,
+                                       &set.engine_report);
+    if (ret == SGX_SUCCESS && keys.index && keys.index->holds_values()) {
+        free_values(keys.values, set.count);
+    }
+    return ret;
+}
+
+sgx_status_t ecall_set_lookup_engine(uint32_t engine) {
+    if (engine >= LOOKUP_ENGINE_COUNT && engine != LOOKUP_ENGINE_AUTO) {
+        return SGX_ERROR_INVALID_PARAMETER;
+    }
+
+    g_lookup_engine = engine;
+
+    // Rebuild every loaded set straight away so the next query runs against
+    // the selected engine; if one fails, all fall back to linear
+    sgx_status_t ret = SGX_SUCCESS;
+    for (std::atomic<SecretSet*>& slot : g_sets) {
+        SecretSet* set = slot.load();
+        if (set && ret == SGX_SUCCESS) {
+            ret = DISPATCH_KEY_TYPE(set->key_type, rebuild_set_index, (*set));
+        }
+    }
+
+    if (ret != SGX_SUCCESS) {
+        g_lookup_engine = LOOKUP_ENGINE_LINEAR;
+        for (std::atomic<SecretSet*>& slot : g_sets) {
+            SecretSet* set = slot.load();
+            if (set && DISPATCH_KEY_TYPE(set->key_type, rebuild_set_index, (*set)) != SGX_SUCCESS) {
+                publish_set(slot, nullptr);
+            }
+        }
+    }
+    return ret;
+}
+
+// Takes effect at the next load, which evicts sets until it fits
+sgx_status_t ecall_set_memory_budget(uint64_t bytes) {
+    g_memory_budget = bytes;
+    return SGX_SUCCESS;
+}
+
+// Queries already running against the set finish first; it is freed once the
+// last of them returns
+sgx_status_t ecall_release_secret_set(uint32_t set_id) {
+    std::atomic<SecretSet*>* slot = slot_of(set_id);
+    if (!slot) {
+        return SGX_ERROR_INVALID_STATE;
+    }
+
+    publish_set(*slot, nullptr);
+    return SGX_SUCCESS;
+}
+
+sgx_status_t ecall_set_batch_mode(uint32_t mode) {
+    if (mode >= BATCH_MODE_COUNT) {
+        return SGX_ERROR_INVALID_PARAMETER;
+    }
+
+    g_batch_mode = mode;
+    return SGX_SUCCESS;
+}
+
+// threshold only matters for RESULT_MODE_THRESHOLD
+sgx_status_t ecall_set_result_mode(uint32_t mode, uint32_t threshold) {
+    if (mode >= RESULT_MODE_COUNT) {
+        return SGX_ERROR_INVALID_PARAMETER;
+    }
+
+    g_result_mode = mode;
+    g_result_threshold = threshold;
+    return SGX_SUCCESS;
+}
+
+// Decrypts an encrypted TestData blob into decrypted_data (sizeof(TestData) bytes)
+// and validates its header
+static sgx_status_t decrypt_test_data(const uint8_t* encrypted_data, size_t encrypted_size,
+                                      uint8_t* decrypted_data) {
+    // Start timing decryption
+    uint64_t decrypt_start;
+    uint64_t retval;
+    if (ocall_get_current_time(&retval, &decrypt_start) != SGX_SUCCESS) {
+        return SGX_ERROR_UNEXPECTED;
+    }
+
+    // Ensure 16-byte alignment
+    alignas(16) uint8_t aligned_key[AES_KEY_SIZE];
+    alignas(16) uint8_t aligned_ctr[AES_BLOCK_SIZE];
+
+    memcpy(aligned_key, g_aes_key, AES_KEY_SIZE);
+    memcpy(aligned_ctr, g_aes_counter, AES_BLOCK_SIZE);
+
+    // Process decryption in chunks
+    size_t remaining = encrypted_size;
+    size_t offset = 0;
+
+    while (remaining > 0) {
+        size_t chunk = min_size_t(remaining, CHUNK_SIZE);
+
+        sgx_status_t ret = sgx_aes_ctr_decrypt(
+            (const sgx_aes_ctr_128bit_key_t*)aligned_key,
+            encrypted_data + offset,
+            (uint32_t)chunk,
+            aligned_ctr,
+            128,  // Initial counter value
+            decrypted_data + offset
+        );
+
+        if (ret != SGX_SUCCESS) {
+            print_debug("Decryption failed with error code: %d\n", ret);
+            return ret;
+        }
+
+        remaining -= chunk;
+        offset += chunk;
+    }
+
+    // End timing decryption
+    uint64_t current_time;
+    if (ocall_get_current_time(&retval, &current_time) != SGX_SUCCESS) {
+        return SGX_ERROR_UNEXPECTED;
+    }
+    g_timing.decryption_time += current_time - decrypt_start;
+
+    // Verify decrypted data
+    const TestData* test_data = (const TestData*)decrypted_data;
+    if (test_data->version != CURRENT_VERSION) {
+        print_debug("Error: Invalid version in decrypted data\n");
+        return SGX_ERROR_UNEXPECTED;
+    }
+
+    if (test_data->count == 0 || test_data->count > MAX_VALUES) {
+        print_debug("Error: Invalid count in decrypted data\n");
+        return SGX_ERROR_UNEXPECTED;
+    }
+
+    return SGX_SUCCESS;
+}
+
+// Whether a batch is checked through a whole-batch bitmap pass rather than
+// one set_contains per query. Merging needs the set's own array, so a set
+// whose index holds its values always takes the lookup path; interleaving
+// needs an index, so the linear engine does too.
+template <typename Key>
+static bool checks_into_bitmap(const SetKeys<Key>& keys) {
+    return (g_batch_mode == BATCH_MODE_MERGE && keys.values) ||
+           (g_batch_mode == BATCH_MODE_INTERLEAVED && keys.index);
+}
+
+// Corrects a bitmap computed against the set as loaded for its pending updates
+template <typename Key>
+static void apply_delta_to_bitmap(const SecretSet& set, const Key* numbers, size_t count,
+                                  uint8_t* bitmap) {
+    const SetKeys<Key>& keys = keys_of<Key>(set);
+    if (keys.inserts.size() == 0 && keys.deletes.size() == 0) {
+        return;
+    }
+
+    // Every bit is rewritten without branching on it
+    for (size_t i = 0; i < count; i++) {
+        int shift = (int)(i & 7);
+        int result = apply_delta(set, numbers[i], (bitmap[i >> 3] >> shift) & 1);
+        bitmap[i >> 3] = (uint8_t)((bitmap[i >> 3] & ~(1u << shift)) | ((unsigned)result << shift));
+    }
+}
+
+// Sets bit i of the caller-zeroed bitmap for every numbers[i] in the set. The
+// lookup path stores every bit without branching on it.
+template <typename Key>
+static sgx_status_t check_into_bitmap(const SecretSet& set, const Key* numbers, size_t count,
+                                      uint8_t* bitmap) {
+    const SetKeys<Key>& keys = keys_of<Key>(set);
+    if (checks_into_bitmap(keys)) {
+        if (g_batch_mode == BATCH_MODE_MERGE) {
+            if (!bulk_intersect(keys.values, set.count, numbers, count, bitmap)) {
+                return SGX_ERROR_OUT_OF_MEMORY;
+            }
+        } else {
+            keys.index->contains_batch(numbers, count, bitmap);
+        }
+        apply_delta_to_bitmap(set, numbers, count, bitmap);
+        return SGX_SUCCESS;
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        bitmap[i >> 3] |= (uint8_t)(set_contains(set, numbers[i]) << (i & 7));
+    }
+    return SGX_SUCCESS;
+}
+
+// Adds how many of numbers are in the set to matches, keeping no per-query
+// result. Merging and interleaving produce a bitmap, so they count through a
+// transient one; lookups sum set_contains directly.
+template <typename Key>
+static sgx_status_t count_matches(const SecretSet& set, const Key* numbers, size_t count,
+                                  uint64_t* matches) {
+    const SetKeys<Key>& keys = keys_of<Key>(set);
+    if (checks_into_bitmap(keys)) {
+        size_t bitmap_size = RESULT_BITMAP_BYTES(count);
+        uint8_t* bitmap = (uint8_t*)calloc(bitmap_size, 1);
+        if (!bitmap) {
+            return SGX_ERROR_OUT_OF_MEMORY;
+        }
+
+        sgx_status_t ret = check_into_bitmap(set, numbers, count, bitmap);
+        for (size_t i = 0; ret == SGX_SUCCESS && i < bitmap_size; i++) {
+            *matches += __builtin_popcount(bitmap[i]);
+        }
+
+        memset(bitmap, 0, bitmap_size);  // Secure cleanup
+        free(bitmap);
+        return ret;
+    }
+
+    uint64_t found = 0;
+    for (size_t i = 0; i < count; i++) {
+        found += set_contains(set, numbers[i]);
+    }
+    *matches += found;
+    return SGX_SUCCESS;
+}
+
+// Checks count values in the selected result mode: into bitmap, which only
+// RESULT_MODE_BITMAP allocates, or onto matches for the summary modes
+template <typename Key>
+static sgx_status_t check_into_result(const SecretSet& set, const Key* numbers, size_t count,
+                                      uint8_t* bitmap, uint64_t* matches) {
+    if (g_result_mode == RESULT_MODE_BITMAP) {
+        return check_into_bitmap(set, numbers, count, bitmap);
+    }
+    return count_matches(set, numbers, count, matches);
+}
+
+// Encrypts size bytes of result into encrypted_results behind a fresh random
+// IV and the GCM tag. Each call draws its own IV, so a whole batch costs one
+// AES-GCM call and never reuses a keystream.
+static sgx_status_t encrypt_result(const uint8_t* result, size_t size,
+                                   uint8_t* encrypted_results) {
+    uint8_t* iv = encrypted_results;
+    uint8_t* tag = encrypted_results + RESULT_IV_SIZE;
+    sgx_status_t ret = sgx_read_rand(iv, RESULT_IV_SIZE);
+    if (ret != SGX_SUCCESS) {
+        return ret;
+    }
+
+    return sgx_rijndael128GCM_encrypt(
+        (const sgx_aes_gcm_128bit_key_t*)g_aes_key,
+        result,
+        (uint32_t)size,
+        encrypted_results + RESULT_HEADER_SIZE,
+        iv,
+        RESULT_IV_SIZE,
+        NULL,
+        0,
+        (sgx_aes_gcm_128bit_tag_t*)tag
+    );
+}
+
+// Writes the result of count queries in the selected result mode to
+// encrypted_results (see RESULT_MODE_SIZE): the bitmap, or a ResultSummary
+// of matches. The threshold compare does not branch on the count.
+static sgx_status_t encrypt_results(const uint8_t* bitmap, size_t count, uint64_t matches,
+                                    uint8_t* encrypted_results) {
+    if (g_result_mode == RESULT_MODE_BITMAP) {
+        return encrypt_result(bitmap, RESULT_BITMAP_BYTES(count), encrypted_results);
+    }
+
+    ResultSummary summary;
+    summary.mode = g_result_mode;
+    summary.value = (g_result_mode == RESULT_MODE_THRESHOLD) ?
+                    (uint32_t)(matches >= g_result_threshold) : (uint32_t)matches;
+    sgx_status_t ret = encrypt_result((const uint8_t*)&summary, sizeof(summary), encrypted_results);
+    memset(&summary, 0, sizeof(summary));  // Secure cleanup
+    return ret;
+}
+
+// Checks count values and writes their encrypted result to encrypted_results
+template <typename Key>
+static sgx_status_t check_and_encrypt_batch(const SecretSet& set, const Key* numbers, size_t count,
+                                            uint8_t* encrypted_results) {
+    size_t bitmap_size = (g_result_mode == RESULT_MODE_BITMAP) ? RESULT_BITMAP_BYTES(count) : 0;
+    uint8_t* bitmap = nullptr;
+    if (bitmap_size != 0 && !(bitmap = (uint8_t*)calloc(bitmap_size, 1))) {
+        return SGX_ERROR_OUT_OF_MEMORY;
+    }
+
+    // Start total timing
+    uint64_t retval;
+    uint64_t start_time;
+    if (ocall_get_current_time(&retval, &start_time) != SGX_SUCCESS) {
+        free(bitmap);
+        return SGX_ERROR_UNEXPECTED;
+    }
+
+    uint64_t matches = 0;
+    sgx_status_t ret = check_into_result(set, numbers, count, bitmap, &matches);
+
+    // End processing timing
+    uint64_t process_end_time;
+    if (ocall_get_current_time(&retval, &process_end_time) != SGX_SUCCESS) {
+        ret = SGX_ERROR_UNEXPECTED;
+    }
+
+    if (ret == SGX_SUCCESS) {
+        g_timing.processing_time += process_end_time - start_time;
+        ret = encrypt_results(bitmap, count, matches, encrypted_results);
+    }
+
+    if (bitmap) {
+        memset(bitmap, 0, bitmap_size);  // Secure cleanup
+        free(bitmap);
+    }
+
+    if (ret != SGX_SUCCESS) {
+        return ret;
+    }
+
+    // End encryption and total timing
+    uint64_t current_time;
+    if (ocall_get_current_time(&retval, &current_time) != SGX_SUCCESS) {
+        return SGX_ERROR_UNEXPECTED;
+    }
+
+    g_timing.encryption_time += current_time - process_end_time;
+    g_timing.total_time = current_time - start_time;
+
+    return SGX_SUCCESS;
+}
+
+// Returns the header of a well-formed compact query file, or nullptr
+static const QueryFileHeader* parse_query_file(const uint8_t* file, size_t file_size) {
+    if (!file || file_size < sizeof(QueryFileHeader)) {
+        return nullptr;
+    }
+
+    const QueryFileHeader* header = (const QueryFileHeader*)file;
+    if (header->magic != QUERY_FILE_MAGIC || header->version != CURRENT_VERSION ||
+        header->key_type >= KEY_TYPE_COUNT || header->count == 0 || header->count > MAX_VALUES ||
+        header->chunk_values == 0 || header->chunk_values > QUERY_MAX_CHUNK_VALUES ||
+        header->chunk_values % 8 != 0 ||
+        file_size != QUERY_FILE_SIZE(header->count, header->chunk_values, header->key_type)) {
+        return nullptr;
+    }
+    return header;
+}
+
+// Authenticates and decrypts chunk index of a parsed query file into values
+// (up to header->chunk_values entries of its key type); returns the chunk's
+// value count in chunk_count
+static sgx_status_t decrypt_query_chunk(const uint8_t* file, const QueryFileHeader* header,
+                                        uint32_t index, void* values, uint32_t* chunk_count) {
+    size_t key_size = KEY_TYPE_SIZE(header->key_type);
+    uint32_t first = index * header->chunk_values;
+    uint32_t count = header->count - first;
+    if (count > header->chunk_values) {
+        count = header->chunk_values;
+    }
+
+    const uint8_t* chunk = file + sizeof(QueryFileHeader) +
+        (size_t)index * (QUERY_CHUNK_HEADER_SIZE + (size_t)header->chunk_values * key_size);
+
+    uint8_t aad[sizeof(QueryFileHeader) + sizeof(uint32_t)];
+    memcpy(aad, header, sizeof(QueryFileHeader));
+    memcpy(aad + sizeof(QueryFileHeader), &index, sizeof(uint32_t));
+
+    *chunk_count = count;
+    return sgx_rijndael128GCM_decrypt(
+        (const sgx_aes_gcm_128bit_key_t*)g_aes_key,
+        chunk + QUERY_CHUNK_HEADER_SIZE,
+        (uint32_t)(count * key_size),
+        (uint8_t*)values,
+        chunk,
+        QUERY_CHUNK_IV_SIZE,
+        aad,
+        sizeof(aad),
+        (const sgx_aes_gcm_128bit_tag_t*)(chunk + QUERY_CHUNK_IV_SIZE)
+    );
+}
+
+sgx_status_t ecall_decrypt_test_data(const uint8_t* encrypted_data, size_t encrypted_size,
+                                    uint8_t* decrypted_data, size_t decrypted_size) {
+    if (!encrypted_data || !decrypted_data || 
+        encrypted_size == 0 || encrypted_size != decrypted_size || 
+        encrypted_size != sizeof(TestData) || !g_aes_initialized) {
+        print_debug("Error: Invalid parameters for decryption\n");
+        return SGX_ERROR_INVALID_PARAMETER;
+    }
 
-static uint8_t g_aes_key[AES_KEY_SIZE];
-static uint8_t g_aes_counter[AES_BLOCK_SIZE];
-static bool g_aes_initialized = false;
+    return decrypt_test_data(encrypted_data, encrypted_size, decrypted_data);
+}
 
-struct TimingInfo {
-    uint64_t start_time;
-    uint64_t encryption_time;
-    uint64_t decryption_time;
-    uint64_t processing_time;
-    uint64_t total_time;
-};
+sgx_status_t ecall_process_encrypted_queries(uint32_t set_id,
+                                             const uint8_t* encrypted_data, size_t encrypted_size,
+                                             uint8_t* encrypted_results, size_t result_size,
+                                             uint32_t* result_count) {
+    if (!g_aes_initialized || !encrypted_data || !encrypted_results || !result_count ||
+        encrypted_size != sizeof(TestData)) {
+        return SGX_ERROR_INVALID_PARAMETER;
+    }
 
-static TimingInfo g_timing = {0, 0, 0, 0, 0};
+    ReadSection reading;
+    const SecretSet* set = use_set(set_id);
+    if (!set) {
+        return SGX_ERROR_INVALID_STATE;
+    }
+    if (set->key_type != KEY_TYPE_INT32) {
+        return SGX_ERROR_INVALID_PARAMETER;  // TestData holds 32-bit values only
+    }
 
-// Helper function to get minimum of two values
-static inline size_t min_size_t(size_t a, size_t b) {
-    return (a < b) ? a : b;
+    // The plaintext queries never leave this buffer
+    TestData* test_data = (TestData*)aligned_malloc(sizeof(TestData), 16);
+    if (!test_data) {
+        return SGX_ERROR_OUT_OF_MEMORY;
+    }
+
+    sgx_status_t ret = decrypt_test_data(encrypted_data, encrypted_size, (uint8_t*)test_data);
+    if (ret == SGX_SUCCESS && result_size < RESULT_MODE_SIZE(g_result_mode, test_data->count)) {
+        ret = SGX_ERROR_INVALID_PARAMETER;
+    }
+
+    if (ret == SGX_SUCCESS) {
+        ret = check_and_encrypt_batch(*set, test_data->values, test_data->count, encrypted_results);
+    }
+
+    if (ret == SGX_SUCCESS) {
+        *result_count = test_data->count;
+    }
+
+    memset(test_data, 0, sizeof(TestData));  // Secure cleanup
+    free(test_data);
+    return ret;
 }
 
-// Helper function for aligned memory allocation
-static void* aligned_malloc(size_t size, size_t alignment) {
-    void* ptr = NULL;
-    if (posix_memalign(&ptr, alignment, size) != 0) {
-        return NULL;
+// Decrypts every chunk of a parsed query file into values, header->count
+// entries of its key type
+static sgx_status_t decrypt_query_values(const uint8_t* file, const QueryFileHeader* header,
+                                         uint8_t* values) {
+    uint64_t retval;
+    uint64_t decrypt_start;
+    if (ocall_get_current_time(&retval, &decrypt_start) != SGX_SUCCESS) {
+        return SGX_ERROR_UNEXPECTED;
     }
-    return ptr;
+
+    size_t key_size = KEY_TYPE_SIZE(header->key_type);
+    uint32_t chunks = (uint32_t)QUERY_CHUNK_COUNT(header->count, header->chunk_values);
+    for (uint32_t index = 0; index < chunks; index++) {
+        uint32_t chunk_count;
+        sgx_status_t ret = decrypt_query_chunk(file, header, index,
+                                               values + (size_t)index * header->chunk_values * key_size,
+                                               &chunk_count);
+        if (ret != SGX_SUCCESS) {
+            memset(values, 0, (size_t)header->count * key_size);
+            return ret;
+        }
+    }
+
+    uint64_t decrypt_end;
+    if (ocall_get_current_time(&retval, &decrypt_end) != SGX_SUCCESS) {
+        return SGX_ERROR_UNEXPECTED;
+    }
+    g_timing.decryption_time += decrypt_end - decrypt_start;
+
+    return SGX_SUCCESS;
 }
 
-// Helper function to format and print messages
-void print_debug(const char* format, ...) {
-    char buf[1024];
-    va_list ap;
-    va_start(ap, format);
-    vsnprintf(buf, sizeof(buf), format, ap);
-    va_end(ap);
-    ocall_print_string(buf);
+// Only 32-bit query files can be decrypted into the host's int array
+sgx_status_t ecall_decrypt_query_file(const uint8_t* file, size_t file_size,
+                                     int* values, size_t value_count) {
+    const QueryFileHeader* header = parse_query_file(file, file_size);
+    if (!header || !g_aes_initialized || !values || value_count != header->count ||
+        header->key_type != KEY_TYPE_INT32) {
+        return SGX_ERROR_INVALID_PARAMETER;
+    }
+
+    return decrypt_query_values(file, header, (uint8_t*)values);
 }
 
-// Helper function to allocate secret data with proper alignment
-static bool allocate_secret_data() {
-    size_t required_size = sizeof(SecretData);
-    void* ptr = aligned_malloc(required_size, 16);  // 16-byte alignment for better performance
+template <typename Key>
+static sgx_status_t process_query_file(const SecretSet& set, const uint8_t* file,
+                                       const QueryFileHeader* header,
+                                       uint8_t* encrypted_results, uint32_t* result_count) {
+    size_t bitmap_size = (g_result_mode == RESULT_MODE_BITMAP) ? RESULT_BITMAP_BYTES(header->count) : 0;
+    size_t chunk_size = (size_t)header->chunk_values * sizeof(Key);
+    uint8_t* bitmap = bitmap_size ? (uint8_t*)calloc(bitmap_size, 1) : nullptr;
+    Key* chunk = (Key*)aligned_malloc(chunk_size, 16);
+    if ((bitmap_size && !bitmap) || !chunk) {
+        free(bitmap);
+        free(chunk);
+        return SGX_ERROR_OUT_OF_MEMORY;
+    }
+
+    uint64_t retval;
+    uint64_t start_time;
+    sgx_status_t ret = SGX_SUCCESS;
+    if (ocall_get_current_time(&retval, &start_time) != SGX_SUCCESS) {
+        ret = SGX_ERROR_UNEXPECTED;
+    }
+
+    uint32_t chunks = (uint32_t)QUERY_CHUNK_COUNT(header->count, header->chunk_values);
+    uint64_t chunk_start = start_time;
+    uint64_t matches = 0;
+    for (uint32_t index = 0; index < chunks && ret == SGX_SUCCESS; index++) {
+        uint32_t chunk_count;
+        ret = decrypt_query_chunk(file, header, index, chunk, &chunk_count);
+
+        uint64_t decrypt_end;
+        if (ret == SGX_SUCCESS && ocall_get_current_time(&retval, &decrypt_end) != SGX_SUCCESS) {
+            ret = SGX_ERROR_UNEXPECTED;
+        }
+
+        // chunk_values is a multiple of 8, so every chunk starts on a bitmap byte
+        if (ret == SGX_SUCCESS) {
+            g_timing.decryption_time += decrypt_end - chunk_start;
+            ret = check_into_result(set, chunk, chunk_count,
+                                    bitmap ? bitmap + (size_t)index * header->chunk_values / 8 : nullptr,
+                                    &matches);
+        }
+
+        if (ret == SGX_SUCCESS && ocall_get_current_time(&retval, &chunk_start) != SGX_SUCCESS) {
+            ret = SGX_ERROR_UNEXPECTED;
+        }
+        if (ret == SGX_SUCCESS) {
+            g_timing.processing_time += chunk_start - decrypt_end;
+        }
+    }
+
+    if (ret == SGX_SUCCESS) {
+        ret = encrypt_results(bitmap, header->count, matches, encrypted_results);
+    }
+
+    uint64_t current_time;
+    if (ret == SGX_SUCCESS && ocall_get_current_time(&retval, &current_time) != SGX_SUCCESS) {
+        ret = SGX_ERROR_UNEXPECTED;
+    }
 
-    if (!ptr) {
-        return false;
+    if (ret == SGX_SUCCESS) {
+        g_timing.encryption_time += current_time - chunk_start;
+        g_timing.total_time = current_time - start_time;
+        *result_count = header->count;
     }
 
-    g_secret_data = (SecretData*)ptr;
-    return true;
+    memset(chunk, 0, chunk_size);  // Secure cleanup
+    if (bitmap) {
+        memset(bitmap, 0, bitmap_size);
+    }
+    free(chunk);
+    free(bitmap);
+    return ret;
 }
 
-sgx_status_t ecall_initialize_aes_key(const uint8_t* key_data, size_t key_size) {
-    if (!key_data || key_size != (AES_KEY_SIZE + AES_BLOCK_SIZE)) {
+// Decrypts and checks one chunk at a time, so at most chunk_values plaintext
+// queries exist at once and decryption cost follows the real query count.
+// The file's key type must be the set's.
+sgx_status_t ecall_process_query_file(uint32_t set_id, const uint8_t* file, size_t file_size,
+                                      uint8_t* encrypted_results, size_t result_size,
+                                      uint32_t* result_count) {
+    const QueryFileHeader* header = parse_query_file(file, file_size);
+    if (!header || !g_aes_initialized ||
+        !encrypted_results || !result_count ||
+        result_size < RESULT_MODE_SIZE(g_result_mode, header->count)) {
         return SGX_ERROR_INVALID_PARAMETER;
     }
 
-    // Ensure proper alignment of key data
-    memcpy(g_aes_key, key_data, AES_KEY_SIZE);
-    memcpy(g_aes_counter, key_data + AES_KEY_SIZE, AES_BLOCK_SIZE);
-    g_aes_initialized = true;
+    ReadSection reading;
+    const SecretSet* set = use_set(set_id);
+    if (!set) {
+        return SGX_ERROR_INVALID_STATE;
+    }
+    if (header->key_type != set->key_type) {
+        return SGX_ERROR_INVALID_PARAMETER;
+    }
 
-    return SGX_SUCCESS;
+    return DISPATCH_KEY_TYPE(set->key_type, process_query_file,
+                             (*set, file, header, encrypted_results, result_count));
+}
+
+// Position of value among a keyed set's sorted values, or -1 if it is not in
+// the set; keyed sets take no updates, so none are pending. An index that
+// holds the values finds the position itself, any other only rules out
+// misses before the sorted array is searched.
+template <typename Key>
+static int64_t find_position(const SecretSet& set, Key value) {
+    const SetKeys<Key>& keys = keys_of<Key>(set);
+    if (!keys.values) {
+        return keys.index->find(value);
+    }
+    if (keys.index && !keys.index->contains(value)) {
+        return -1;
+    }
+
+    const Key* values = keys.values;
+    const Key* end = values + set.count;
+    const Key* found = std::lower_bound(values, end, value);
+    return (found != end && *found == value) ? found - values : -1;
+}
+
+// payloads[position], or 0 for -1, read by touching every payload so the
+// oblivious engine's memory accesses still do not depend on the query
+static uint32_t oblivious_payload(const uint32_t* payloads, uint32_t count, int64_t position) {
+    uint32_t payload = 0;
+    for (uint32_t i = 0; i < count; i++) {
+        payload |= payloads[i] & (0u - (uint32_t)(i == position));
+    }
+    return payload;
+}
+
+// Sets bit i of the caller-zeroed bitmap and payload i of payloads, a
+// possibly unaligned array, for every numbers[i] in a keyed set
+template <typename Key>
+static void lookup_payload_chunk(const SecretSet& set, const Key* numbers, size_t count,
+                                 uint8_t* bitmap, uint8_t* payloads) {
+    bool oblivious = (set.engine_report.engine == LOOKUP_ENGINE_OBLIVIOUS);
+    for (size_t i = 0; i < count; i++) {
+        int64_t position = find_position(set, numbers[i]);
+        uint32_t found = (uint32_t)(position >= 0);
+        uint32_t payload = oblivious ? oblivious_payload(set.payloads, set.count, position) :
+                           found ? set.payloads[position] : 0;
+        bitmap[i >> 3] |= (uint8_t)(found << (i & 7));
+        memcpy(payloads + i * PAYLOAD_SIZE, &payload, PAYLOAD_SIZE);
+    }
+}
+
+template <typename Key>
+static sgx_status_t lookup_payloads(const SecretSet& set, const uint8_t* file,
+                                    const QueryFileHeader* header,
+                                    uint8_t* encrypted_results, uint32_t* result_count) {
+    size_t bitmap_size = RESULT_BITMAP_BYTES(header->count);
+    size_t result_size = PAYLOAD_RESULT_SIZE(header->count) - RESULT_HEADER_SIZE;
+    size_t chunk_size = (size_t)header->chunk_values * sizeof(Key);
+    uint8_t* result = (uint8_t*)calloc(result_size, 1);
+    Key* chunk = (Key*)aligned_malloc(chunk_size, 16);
+    if (!result || !chunk) {
+        free(result);
+        free(chunk);
+        return SGX_ERROR_OUT_OF_MEMORY;
+    }
+
+    uint64_t retval;
+    uint64_t start_time;
+    sgx_status_t ret = SGX_SUCCESS;
+    if (ocall_get_current_time(&retval, &start_time) != SGX_SUCCESS) {
+        ret = SGX_ERROR_UNEXPECTED;
+    }
+
+    uint32_t chunks = (uint32_t)QUERY_CHUNK_COUNT(header->count, header->chunk_values);
+    uint64_t chunk_start = start_time;
+    for (uint32_t index = 0; index < chunks && ret == SGX_SUCCESS; index++) {
+        uint32_t chunk_count;
+        ret = decrypt_query_chunk(file, header, index, chunk, &chunk_count);
+
+        uint64_t decrypt_end;
+        if (ret == SGX_SUCCESS && ocall_get_current_time(&retval, &decrypt_end) != SGX_SUCCESS) {
+            ret = SGX_ERROR_UNEXPECTED;
+        }
+
+        if (ret == SGX_SUCCESS) {
+            size_t first = (size_t)index * header->chunk_values;
+            g_timing.decryption_time += decrypt_end - chunk_start;
+            lookup_payload_chunk(set, chunk, chunk_count, result + first / 8,
+                                 result + bitmap_size + first * PAYLOAD_SIZE);
+        }
+
+        if (ret == SGX_SUCCESS && ocall_get_current_time(&retval, &chunk_start) != SGX_SUCCESS) {
+            ret = SGX_ERROR_UNEXPECTED;
+        }
+        if (ret == SGX_SUCCESS) {
+            g_timing.processing_time += chunk_start - decrypt_end;
+        }
+    }
+
+    if (ret == SGX_SUCCESS) {
+        ret = encrypt_result(result, result_size, encrypted_results);
+    }
+
+    uint64_t current_time;
+    if (ret == SGX_SUCCESS && ocall_get_current_time(&retval, &current_time) != SGX_SUCCESS) {
+        ret = SGX_ERROR_UNEXPECTED;
+    }
+
+    if (ret == SGX_SUCCESS) {
+        g_timing.encryption_time += current_time - chunk_start;
+        g_timing.total_time = current_time - start_time;
+        *result_count = header->count;
+    }
+
+    memset(chunk, 0, chunk_size);  // Secure cleanup
+    memset(result, 0, result_size);
+    free(chunk);
+    free(result);
+    return ret;
 }
 
-sgx_status_t ecall_initialize_secret_data(const uint8_t* sealed_data, size_t sealed_size) {
-    if (!sealed_data || sealed_size != sizeof(SecretData)) {
+// Joins the queries of a compact query file against a keyed set of the same
+// key type, returning each one's payload (see PAYLOAD_RESULT_SIZE). Chunks
+// are decrypted one at a time as in ecall_process_query_file; lookups always
+// go through the selected engine, whatever the batch and result modes.
+sgx_status_t ecall_lookup_payloads(uint32_t set_id, const uint8_t* file, size_t file_size,
+                                   uint8_t* encrypted_results, size_t result_size,
+                                   uint32_t* result_count) {
+    const QueryFileHeader* header = parse_query_file(file, file_size);
+    if (!header || !g_aes_initialized || !encrypted_results || !result_count ||
+        result_size < PAYLOAD_RESULT_SIZE(header->count)) {
+        return SGX_ERROR_INVALID_PARAMETER;
+    }
+
+    ReadSection reading;
+    const SecretSet* set = use_set(set_id);
+    if (!set) {
+        return SGX_ERROR_INVALID_STATE;
+    }
+    if (header->key_type != set->key_type || !set->payloads) {
         return SGX_ERROR_INVALID_PARAMETER;
     }
 
-    // Clean up any existing data
-    if (g_secret_data) {
-        memset(g_secret_data, 0, sizeof(SecretData));  // Secure cleanup
-        free(g_secret_data);
-        g_secret_data = nullptr;
+    return DISPATCH_KEY_TYPE(set->key_type, lookup_payloads,
+                             (*set, file, header, encrypted_results, result_count));
+}
+
+template <typename Key>
+static sgx_status_t update_secret_set(SecretSet& set, uint32_t op, const uint8_t* file,
+                                      const QueryFileHeader* header, uint8_t* record,
+                                      size_t record_size, uint32_t* record_used,
+                                      uint32_t* delta_size) {
+    DeltaRecordHeader record_header;
+    record_header.magic = DELTA_MAGIC;
+    record_header.op = op;
+    record_header.generation = set.generation;
+    record_header.sequence = set.sequence;
+    record_header.count = header->count;
+
+    size_t values_size = (size_t)header->count * sizeof(Key);
+    uint32_t needed = sgx_calc_sealed_data_size(sizeof(record_header), (uint32_t)values_size);
+    if (needed == UINT32_MAX || needed > record_size) {
+        return SGX_ERROR_INVALID_PARAMETER;
     }
 
-    // Allocate memory for the secret data
-    if (!allocate_secret_data()) {
+    Key* values = (Key*)aligned_malloc(values_size, 16);
+    if (!values) {
         return SGX_ERROR_OUT_OF_MEMORY;
     }
 
-    // Copy the sealed data in chunks to prevent memory pressure
-    size_t remaining = sealed_size;
-    size_t offset = 0;
-    const uint8_t* src = sealed_data;
-    uint8_t* dst = (uint8_t*)g_secret_data;
+    sgx_status_t ret = decrypt_query_values(file, header, (uint8_t*)values);
+    if (ret == SGX_SUCCESS) {
+        ret = sgx_seal_data(sizeof(record_header), (const uint8_t*)&record_header,
+                            (uint32_t)values_size, (const uint8_t*)values,
+                            needed, (sgx_sealed_data_t*)record);
+    }
+    if (ret == SGX_SUCCESS) {
+        ret = apply_update(set, op, values, header->count);
+    }
 
-    while (remaining > 0) {
-        size_t chunk = min_size_t(remaining, CHUNK_SIZE);
-        memcpy(dst + offset, src + offset, chunk);
-        remaining -= chunk;
-        offset += chunk;
+    const SetKeys<Key>& keys = keys_of<Key>(set);
+    if (ret == SGX_SUCCESS) {
+        set.sequence++;
+        *record_used = needed;
+        *delta_size = keys.inserts.size() + keys.deletes.size();
     }
 
-    // Validate the data
-    if (g_secret_data->version != CURRENT_VERSION) {
-        memset(g_secret_data, 0, sizeof(SecretData));
-        free(g_secret_data);
-        g_secret_data = nullptr;
-        return SGX_ERROR_INVALID_VERSION;
+    memset(values, 0, values_size);  // Secure cleanup
+    free(values);
+    return ret;
+}
+
+// Applies a batch of inserts or deletes, given as a compact query file of the
+// set's key type, to the pending updates. The batch is first sealed into
+// record (see DeltaRecordHeader) as the next entry of the delta log; the host
+// appends it to the log only when this call succeeds. Neither the loaded set
+// nor its index is touched, so the cost follows the batch and pending update
+// sizes.
+sgx_status_t ecall_update_secret_set(uint32_t set_id, uint32_t op,
+                                     const uint8_t* file, size_t file_size,
+                                     uint8_t* record, size_t record_size,
+                                     uint32_t* record_used, uint32_t* delta_size) {
+    const QueryFileHeader* header = parse_query_file(file, file_size);
+    if (!header || !g_aes_initialized || op >= UPDATE_OP_COUNT ||
+        !record || !record_used || !delta_size) {
+        return SGX_ERROR_INVALID_PARAMETER;
     }
 
-    if (g_secret_data->count == 0 || g_secret_data->count > MAX_VALUES) {
-        memset(g_secret_data, 0, sizeof(SecretData));
-        free(g_secret_data);
-        g_secret_data = nullptr;
-        return SGX_ERROR_UNEXPECTED;
+    SecretSet* set = use_set(set_id);
+    if (!set) {
+        return SGX_ERROR_INVALID_STATE;
+    }
+    if (header->key_type != set->key_type || set->payloads) {
+        return SGX_ERROR_INVALID_PARAMETER;  // Updates carry no payloads
     }
 
-    g_is_initialized = true;
-    g_page_fault_count = 0;  // Reset page fault counter
+    return DISPATCH_KEY_TYPE(set->key_type, update_secret_set,
+                             (*set, op, file, header, record, record_size, record_used,
+                              delta_size));
+}
 
-    return SGX_SUCCESS;
+template <typename Key>
+static sgx_status_t replay_delta_record(SecretSet& set, const sgx_sealed_data_t* sealed,
+                                        size_t record_size, uint32_t* delta_size) {
+    uint32_t text_size = sgx_get_encrypt_txt_len(sealed);
+    if (sgx_get_add_mac_txt_len(sealed) != sizeof(DeltaRecordHeader) ||
+        text_size == 0 || text_size % sizeof(Key) != 0 ||
+        text_size > (uint64_t)MAX_VALUES * sizeof(Key) ||
+        sgx_calc_sealed_data_size(sizeof(DeltaRecordHeader), text_size) != record_size) {
+        return SGX_ERROR_INVALID_PARAMETER;
+    }
+
+    Key* values = (Key*)aligned_malloc(text_size, 16);
+    if (!values) {
+        return SGX_ERROR_OUT_OF_MEMORY;
+    }
+
+    DeltaRecordHeader header;
+    uint32_t header_size = sizeof(header);
+    uint32_t unsealed_size = text_size;
+    sgx_status_t ret = sgx_unseal_data(sealed, (uint8_t*)&header, &header_size,
+                                       (uint8_t*)values, &unsealed_size);
+    if (ret == SGX_SUCCESS &&
+        (header.magic != DELTA_MAGIC || header.op >= UPDATE_OP_COUNT ||
+         header.generation != set.generation || header.sequence != set.sequence ||
+         (uint64_t)header.count * sizeof(Key) != text_size)) {
+        ret = SGX_ERROR_INVALID_PARAMETER;
+    }
+
+    if (ret == SGX_SUCCESS) {
+        ret = apply_update(set, header.op, values, header.count);
+    }
+
+    const SetKeys<Key>& keys = keys_of<Key>(set);
+    if (ret == SGX_SUCCESS) {
+        set.sequence++;
+        *delta_size = keys.inserts.size() + keys.deletes.size();
+    }
+
+    memset(values, 0, text_size);  // Secure cleanup
+    free(values);
+    return ret;
 }
 
-sgx_status_t ecall_decrypt_test_data(const uint8_t* encrypted_data, size_t encrypted_size,
-                                    uint8_t* decrypted_data, size_t decrypted_size) {
-    if (!encrypted_data || !decrypted_data || 
-        encrypted_size == 0 || encrypted_size != decrypted_size || 
-        encrypted_size != sizeof(TestData) || !g_aes_initialized) {
-        print_debug("Error: Invalid parameters for decryption\n");
+// Re-applies the next record of a set's delta log. Records of another
+// generation or out of sequence are rejected, so a log only replays in full
+// onto the snapshot it was written against.
+sgx_status_t ecall_replay_delta_record(uint32_t set_id, const uint8_t* record, size_t record_size,
+                                       uint32_t* delta_size) {
+    if (!record || !delta_size || record_size < sizeof(sgx_sealed_data_t)) {
         return SGX_ERROR_INVALID_PARAMETER;
     }
 
-    // Start timing decryption
-    uint64_t decrypt_start;
-    uint64_t retval;
-    if (ocall_get_current_time(&retval, &decrypt_start) != SGX_SUCCESS) {
-        return SGX_ERROR_UNEXPECTED;
+    SecretSet* set = find_set(set_id);
+    if (!set) {
+        return SGX_ERROR_INVALID_STATE;
+    }
+    if (set->payloads) {
+        return SGX_ERROR_INVALID_PARAMETER;
     }
 
-    // Ensure 16-byte alignment
-    alignas(16) uint8_t aligned_key[AES_KEY_SIZE];
-    alignas(16) uint8_t aligned_ctr[AES_BLOCK_SIZE];
+    return DISPATCH_KEY_TYPE(set->key_type, replay_delta_record,
+                             (*set, (const sgx_sealed_data_t*)record, record_size, delta_size));
+}
 
-    memcpy(aligned_key, g_aes_key, AES_KEY_SIZE);
-    memcpy(aligned_ctr, g_aes_counter, AES_BLOCK_SIZE);
+template <typename Key>
+static sgx_status_t compact_secret_set(SecretSet& set) {
+    uint64_t generation;
+    sgx_status_t ret = sgx_read_rand((unsigned char*)&generation, sizeof(generation));
+    if (ret != SGX_SUCCESS) {
+        return ret;
+    }
 
-    // Process decryption in chunks
-    size_t remaining = encrypted_size;
-    size_t offset = 0;
+    SetKeys<Key>& keys = keys_of<Key>(set);
+    if (keys.inserts.size() == 0 && keys.deletes.size() == 0) {
+        reset_delta_log<Key>(set, generation);
+        return SGX_SUCCESS;
+    }
 
-    while (remaining > 0) {
-        size_t chunk = min_size_t(remaining, CHUNK_SIZE);
+    uint64_t count = (uint64_t)set.count - keys.deletes.size() + keys.inserts.size();
+    if (count == 0 || count > MAX_VALUES) {
+        return SGX_ERROR_INVALID_PARAMETER;  // Pending updates are kept
+    }
 
-        sgx_status_t ret = sgx_aes_ctr_decrypt(
-            (const sgx_aes_ctr_128bit_key_t*)aligned_key,
-            encrypted_data + offset,
-            (uint32_t)chunk,
-            aligned_ctr,
-            128,  // Initial counter value
-            decrypted_data + offset
-        );
+    Key* values = (Key*)aligned_malloc((size_t)count * sizeof(Key), 16);
+    if (!values) {
+        return SGX_ERROR_OUT_OF_MEMORY;
+    }
 
-        if (ret != SGX_SUCCESS) {
-            print_debug("Decryption failed with error code: %d\n", ret);
-            return ret;
-        }
+    // Values the index holds are merged from a temporary copy
+    Key* loaded = keys.values ? keys.values : copy_set_values<Key>(set);
+    if (!loaded) {
+        free_values(values, (uint32_t)count);
+        return SGX_ERROR_OUT_OF_MEMORY;
+    }
 
-        remaining -= chunk;
-        offset += chunk;
+    // One merge pass: the deletes are a sorted subset of the set as loaded
+    // and the inserts a sorted set disjoint from it
+    const Key* deletes = keys.deletes.values();
+    const Key* inserts = keys.inserts.values();
+    uint32_t next_delete = 0;
+    uint32_t next_insert = 0;
+    uint32_t filled = 0;
+    for (uint32_t i = 0; i < set.count; i++) {
+        Key value = loaded[i];
+        if (next_delete < keys.deletes.size() && deletes[next_delete] == value) {
+            next_delete++;
+            continue;
+        }
+        while (next_insert < keys.inserts.size() && inserts[next_insert] < value) {
+            values[filled++] = inserts[next_insert++];
+        }
+        values[filled++] = value;
+    }
+    while (next_insert < keys.inserts.size()) {
+        values[filled++] = inserts[next_insert++];
+    }
+    if (loaded != keys.values) {
+        free_values(loaded, set.count);
     }
 
-    // End timing decryption
-    uint64_t current_time;
-    if (ocall_get_current_time(&retval, &current_time) != SGX_SUCCESS) {
-        return SGX_ERROR_UNEXPECTED;
+    // The old set keeps serving until the new one is published, so a failure
+    // leaves it and its pending updates as they were
+    LookupIndex<Key>* index;
+    EngineReport report;
+    ret = build_set_index(values, (uint32_t)count, false, &index, &report);
+    if (ret != SGX_SUCCESS) {
+        free_values(values, (uint32_t)count);
+        return ret;
     }
-    g_timing.decryption_time = current_time - decrypt_start;
 
-    // Verify decrypted data
-    const TestData* test_data = (const TestData*)decrypted_data;
-    if (test_data->version != CURRENT_VERSION) {
-        print_debug("Error: Invalid version in decrypted data\n");
-        return SGX_ERROR_UNEXPECTED;
+    // The rebuilt index may outgrow what the pending updates were charged as
+    std::atomic<SecretSet*>* slot =
+        make_room(set.id, loaded_bytes((uint32_t)count, sizeof(Key), false, index));
+    if (!slot) {
+        delete index;
+        free_values(values, (uint32_t)count);
+        return SGX_ERROR_OUT_OF_MEMORY;
     }
 
-    if (test_data->count == 0 || test_data->count > MAX_VALUES) {
-        print_debug("Error: Invalid count in decrypted data\n");
-        return SGX_ERROR_UNEXPECTED;
+    return install_set(*slot, set.id, values, (uint32_t*)nullptr, (uint32_t)count, index,
+                       report, generation);
+}
+
+// Folds the pending updates into a new sorted set and index and starts a new
+// delta log generation, after which the host snapshots the set and drops the
+// old log. This costs as much as a full load, so it belongs off the update path.
+// If the new version does not fit the memory budget the pending updates are
+// kept and SGX_ERROR_OUT_OF_MEMORY is returned.
+sgx_status_t ecall_compact_secret_set(uint32_t set_id) {
+    SecretSet* set = find_set(set_id);
+    if (!set) {
+        return SGX_ERROR_INVALID_STATE;
     }
 
-    return SGX_SUCCESS;
+    return DISPATCH_KEY_TYPE(set->key_type, compact_secret_set, (*set));
 }
 
-sgx_status_t ecall_check_number_encrypted(int number, uint8_t* encrypted_result, 
+sgx_status_t ecall_check_number_encrypted(uint32_t set_id, int number, uint8_t* encrypted_result,
                                          size_t result_size) {
-    if (!g_is_initialized || !g_secret_data || !encrypted_result || 
-        result_size < AES_BLOCK_SIZE) {
+    if (!encrypted_result || result_size < AES_BLOCK_SIZE) {
+        return SGX_ERROR_INVALID_PARAMETER;
+    }
+
+    ReadSection reading;
+    const SecretSet* set = use_set(set_id);
+    if (!set) {
+        return SGX_ERROR_INVALID_STATE;
+    }
+    if (set->key_type != KEY_TYPE_INT32) {
         return SGX_ERROR_INVALID_PARAMETER;
     }
 
@@ -216,10 +2541,9 @@ sgx_status_t ecall_check_number_encrypted(int number, uint8_t* encrypted_result,
     if (ocall_get_current_time(&retval, &start_time) != SGX_SUCCESS) {
         return SGX_ERROR_UNEXPECTED;
     }
-    g_timing.start_time = start_time;
 
     // Get the intersection check result
-    int result = ecall_check_number(number);
+    int result = set_contains(*set, number);
 
     // End processing timing
     uint64_t process_end_time;
@@ -261,35 +2585,38 @@ sgx_status_t ecall_check_number_encrypted(int number, uint8_t* encrypted_result,
     }
 
     g_timing.encryption_time += current_time - encryption_start;
-    g_timing.total_time = current_time - g_timing.start_time;
+    g_timing.total_time = current_time - start_time;
 
     return ret;
 }
 
-int ecall_check_number(int number) {
-    if (!g_is_initialized || !g_secret_data) {
-        return -1;
+sgx_status_t ecall_check_numbers_batch(uint32_t set_id, const int* numbers, size_t count,
+                                       uint8_t* encrypted_results, size_t result_size) {
+    if (!g_aes_initialized || !numbers || !encrypted_results ||
+        count == 0 || count > MAX_VALUES || result_size < RESULT_MODE_SIZE(g_result_mode, count)) {
+        return SGX_ERROR_INVALID_PARAMETER;
     }
 
-    if (g_secret_data->count == 0) {
-        return -2;  // Error: empty data
+    ReadSection reading;
+    const SecretSet* set = use_set(set_id);
+    if (!set) {
+        return SGX_ERROR_INVALID_STATE;
+    }
+    if (set->key_type != KEY_TYPE_INT32) {
+        return SGX_ERROR_INVALID_PARAMETER;
     }
 
-    // Linear search with page fault tracking
-    for (int i = 0; i < g_secret_data->count; i++) {
-        // Track page faults and ensure memory access is within enclave
-        if (sgx_is_within_enclave(&g_secret_data->values[i], sizeof(int))) {
-            g_page_fault_count++;
-        }
+    return check_and_encrypt_batch(*set, numbers, count, encrypted_results);
+}
 
-        // Cache-friendly comparison
-        int current_value = g_secret_data->values[i];
-        if (current_value == number) {
-            return 1;  // Match found
-        }
+int ecall_check_number(uint32_t set_id, int number) {
+    ReadSection reading;
+    const SecretSet* set = use_set(set_id);
+    if (!set || set->key_type != KEY_TYPE_INT32) {
+        return -1;
     }
 
-    return 0;  // No match found
+    return set_contains(*set, number);
 }
 
 sgx_status_t ecall_update_counter(const uint8_t* counter, size_t counter_size) {
@@ -309,11 +2636,15 @@ sgx_status_t ecall_get_page_fault_count(uint64_t* count) {
     return SGX_SUCCESS;
 }
 
-sgx_status_t ecall_get_timing_info(uint64_t* encryption_time, 
+sgx_status_t ecall_get_timing_info(uint32_t set_id,
+                                  uint64_t* encryption_time,
                                   uint64_t* processing_time,
                                   uint64_t* total_time,
-                                  uint64_t* decryption_time) {
-    if (!encryption_time || !processing_time || !total_time || !decryption_time) {
+                                  uint64_t* decryption_time,
+                                  uint64_t* index_build_time,
+                                  uint64_t* index_memory) {
+    if (!encryption_time || !processing_time || !total_time || !decryption_time ||
+        !index_build_time || !index_memory) {
         return SGX_ERROR_INVALID_PARAMETER;
     }
 
@@ -321,28 +2652,52 @@ sgx_status_t ecall_get_timing_info(uint64_t* encryption_time,
     *processing_time = g_timing.processing_time;
     *decryption_time = g_timing.decryption_time;
     *total_time = g_timing.total_time;
+    *index_build_time = g_timing.index_build_time;
+    ReadSection reading;
+    const SecretSet* set = find_set(set_id);
+    *index_memory = set ? DISPATCH_KEY_TYPE(set->key_type, index_memory_bytes, (*set)) : 0;
+
+    return SGX_SUCCESS;
+}
+
+// report receives an EngineReport for set_id's index
+sgx_status_t ecall_get_engine_report(uint32_t set_id, uint8_t* report, size_t report_size) {
+    if (!report || report_size != sizeof(EngineReport)) {
+        return SGX_ERROR_INVALID_PARAMETER;
+    }
+
+    ReadSection reading;
+    const SecretSet* set = find_set(set_id);
+    if (!set) {
+        return SGX_ERROR_INVALID_STATE;
+    }
 
+    memcpy(report, &set->engine_report, sizeof(EngineReport));
     return SGX_SUCCESS;
 }
 
 sgx_status_t ecall_reset_timing() {
-    memset(&g_timing, 0, sizeof(TimingInfo));
+    g_timing.encryption_time = 0;
+    g_timing.decryption_time = 0;
+    g_timing.processing_time = 0;
+    g_timing.total_time = 0;
+    g_timing.index_build_time = 0;
     return SGX_SUCCESS;
 }
 
 void ecall_cleanup() {
-    if (g_secret_data) {
-        // Securely wipe secret data before freeing
-        memset(g_secret_data, 0, sizeof(SecretData));
-        free(g_secret_data);
-        g_secret_data = nullptr;
+    // Securely wipes the secret values before freeing; with no query running,
+    // every retired version goes too
+    for (std::atomic<SecretSet*>& slot : g_sets) {
+        publish_set(slot, nullptr);
     }
+    IngestSection section(true);  // Waits out shard ingests in flight
+    release_snapshot_import();
 
     // Clear all sensitive data
     memset(g_aes_key, 0, AES_KEY_SIZE);
     memset(g_aes_counter, 0, AES_BLOCK_SIZE);
 
-    g_is_initialized = false;
     g_aes_initialized = false;
     g_page_fault_count = 0;
 }
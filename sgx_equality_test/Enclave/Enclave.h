@@ -8,17 +8,65 @@
 extern "C" {
 #endif
 
-int ecall_check_number(int number);
-sgx_status_t ecall_initialize_secret_data(const uint8_t* sealed_data, size_t sealed_size);
+int ecall_check_number(uint32_t set_id, int number);
+sgx_status_t ecall_initialize_secret_data(uint32_t set_id, const uint8_t* sealed_data,
+                                          size_t sealed_size);
+sgx_status_t ecall_begin_secret_data(uint32_t set_id, uint32_t key_type, uint32_t count,
+                                     uint32_t keyed);
+sgx_status_t ecall_append_secret_data(const uint8_t* values, size_t size);
+sgx_status_t ecall_append_secret_payloads(const uint8_t* payloads, size_t size);
+sgx_status_t ecall_commit_secret_data();
+sgx_status_t ecall_ingest_secret_file(uint32_t set_id, const uint8_t* file, size_t file_size);
+sgx_status_t ecall_begin_secret_shards(uint32_t set_id, uint32_t key_type,
+                                       const uint32_t* shard_counts, uint32_t shard_count);
+sgx_status_t ecall_ingest_secret_shard(uint32_t shard, const uint8_t* file, size_t file_size);
+sgx_status_t ecall_commit_secret_shards();
+sgx_status_t ecall_abort_secret_ingest();
+sgx_status_t ecall_export_index_snapshot(uint32_t set_id, uint32_t chunk, uint8_t* sealed_chunk,
+                                         size_t buffer_size, uint32_t* sealed_size,
+                                         uint32_t* chunk_count);
+sgx_status_t ecall_import_index_snapshot(uint32_t set_id, uint32_t chunk, const uint8_t* sealed_chunk,
+                                         size_t sealed_size, uint32_t* chunks_left);
+sgx_status_t ecall_update_secret_set(uint32_t set_id, uint32_t op,
+                                     const uint8_t* file, size_t file_size,
+                                     uint8_t* record, size_t record_size,
+                                     uint32_t* record_used, uint32_t* delta_size);
+sgx_status_t ecall_replay_delta_record(uint32_t set_id, const uint8_t* record, size_t record_size,
+                                       uint32_t* delta_size);
+sgx_status_t ecall_compact_secret_set(uint32_t set_id);
+sgx_status_t ecall_release_secret_set(uint32_t set_id);
+sgx_status_t ecall_set_memory_budget(uint64_t bytes);
+sgx_status_t ecall_set_lookup_engine(uint32_t engine);
+sgx_status_t ecall_set_batch_mode(uint32_t mode);
+sgx_status_t ecall_set_result_mode(uint32_t mode, uint32_t threshold);
 sgx_status_t ecall_get_page_fault_count(uint64_t* count);
 sgx_status_t ecall_decrypt_test_data(const uint8_t* encrypted_data, size_t encrypted_size,
                                     uint8_t* decrypted_data, size_t decrypted_size);
 sgx_status_t ecall_initialize_aes_key(const uint8_t* key_data, size_t key_size);
-sgx_status_t ecall_check_number_encrypted(int number, uint8_t* encrypted_result, size_t result_size);
-sgx_status_t ecall_get_timing_info(uint64_t* encryption_time, 
+sgx_status_t ecall_check_number_encrypted(uint32_t set_id, int number, uint8_t* encrypted_result,
+                                         size_t result_size);
+sgx_status_t ecall_check_numbers_batch(uint32_t set_id, const int* numbers, size_t count,
+                                       uint8_t* encrypted_results, size_t result_size);
+sgx_status_t ecall_process_encrypted_queries(uint32_t set_id,
+                                             const uint8_t* encrypted_data, size_t encrypted_size,
+                                             uint8_t* encrypted_results, size_t result_size,
+                                             uint32_t* result_count);
+sgx_status_t ecall_decrypt_query_file(const uint8_t* file, size_t file_size,
+                                     int* values, size_t value_count);
+sgx_status_t ecall_process_query_file(uint32_t set_id, const uint8_t* file, size_t file_size,
+                                      uint8_t* encrypted_results, size_t result_size,
+                                      uint32_t* result_count);
+sgx_status_t ecall_lookup_payloads(uint32_t set_id, const uint8_t* file, size_t file_size,
+                                   uint8_t* encrypted_results, size_t result_size,
+                                   uint32_t* result_count);
+sgx_status_t ecall_get_timing_info(uint32_t set_id,
+    uint64_t* encryption_time,
     uint64_t* processing_time,
     uint64_t* total_time,
-    uint64_t* decryption_time);
+    uint64_t* decryption_time,
+    uint64_t* index_build_time,
+    uint64_t* index_memory);
+sgx_status_t ecall_get_engine_report(uint32_t set_id, uint8_t* report, size_t report_size);
 
 #if defined(__cplusplus)
 }
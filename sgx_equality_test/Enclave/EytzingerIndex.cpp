@@ -0,0 +1,164 @@
+// EytzingerIndex.cpp
+#include "LookupIndex.h"
+#include <stdlib.h>
+#include <string.h>
+#include <new>
+
+// Sorted values stored in BFS (Eytzinger) order, 1-indexed. The top levels of
+// the tree share a handful of cache lines that stay hot, and each descent
+// prefetches the line holding its great-great-grandchildren so that the miss
+// for level d+4 overlaps the compares for levels d..d+3. Wider keys fit fewer
+// to a line, so the prefetch reaches two (Key128) or three (uint64_t) levels.
+template <typename Key>
+class EytzingerIndex : public LookupIndex<Key> {
+public:
+    // Keys per cache line; the KEYS_PER_LINE descendants log2(KEYS_PER_LINE)
+    // levels below node k sit at k*KEYS_PER_LINE onwards, which is exactly one
+    // line when the array is line aligned.
+    static const size_t KEYS_PER_LINE = CACHE_LINE_SIZE / sizeof(Key);
+
+    EytzingerIndex() : m_keys(nullptr), m_count(0), m_bytes(0) {}
+
+    ~EytzingerIndex() {
+        if (m_keys) {
+            memset(m_keys, 0, m_bytes);  // Secure cleanup
+            free(m_keys);
+        }
+    }
+
+    bool allocate(uint32_t count) {
+        // Slot 0 is unused. Prefetches past the last level land outside the
+        // array, which is harmless since prefetch never faults.
+        m_bytes = ((size_t)count + 1) * sizeof(Key);
+        m_bytes = (m_bytes + CACHE_LINE_SIZE - 1) & ~(size_t)(CACHE_LINE_SIZE - 1);
+
+        void* ptr = NULL;
+        if (posix_memalign(&ptr, CACHE_LINE_SIZE, m_bytes) != 0) {
+            return false;
+        }
+        m_keys = (Key*)ptr;
+        m_count = count;
+        return true;
+    }
+
+    bool build(const Key* sorted_values, uint32_t count) {
+        if (!allocate(count)) {
+            return false;
+        }
+
+        memset(m_keys, 0, m_bytes);
+        fill(sorted_values, 0, 1);
+        return true;
+    }
+
+    bool contains(Key value) const {
+        size_t k = 1;
+        while (k <= m_count) {
+            __builtin_prefetch(m_keys + k * KEYS_PER_LINE);
+            k = 2 * k + (m_keys[k] < value);
+        }
+
+        // Undo the trailing right turns to recover the lower bound
+        k >>= __builtin_ffsll(~(long long)k);
+        return k != 0 && m_keys[k] == value;
+    }
+
+    // Each lookup in flight is its query and the node it descends to next.
+    // A step compares one node, prefetches the child it picks and moves on
+    // to the next lookup; one that falls off the tree records its result and
+    // takes the next query, so every slot keeps a miss outstanding.
+    void contains_batch(const Key* values, size_t count, uint8_t* bitmap) const {
+        size_t query[LOOKUPS_IN_FLIGHT];
+        size_t node[LOOKUPS_IN_FLIGHT];
+        size_t active = 0;
+        size_t next = 0;
+        while (active < LOOKUPS_IN_FLIGHT && next < count) {
+            query[active] = next++;
+            node[active++] = 1;
+        }
+
+        while (active > 0) {
+            for (size_t s = 0; s < active; ) {
+                Key value = values[query[s]];
+                size_t k = 2 * node[s] + (m_keys[node[s]] < value);
+                if (k <= m_count) {
+                    __builtin_prefetch(m_keys + k);
+                    node[s++] = k;
+                    continue;
+                }
+
+                k >>= __builtin_ffsll(~(long long)k);
+                size_t i = query[s];
+                bitmap[i >> 3] |= (uint8_t)((k != 0 && m_keys[k] == value) << (i & 7));
+
+                // Refill the slot, or close the gap with the last one
+                if (next < count) {
+                    query[s] = next++;
+                    node[s] = 1;
+                } else {
+                    active--;
+                    query[s] = query[active];
+                    node[s] = node[active];
+                }
+            }
+        }
+    }
+
+    size_t memory_bytes() const {
+        return m_bytes;
+    }
+
+    void* storage() {
+        return m_keys;
+    }
+
+private:
+    // In-order walk of the implicit tree assigns sorted values to BFS slots
+    size_t fill(const Key* sorted_values, size_t i, size_t k) {
+        if (k <= m_count) {
+            i = fill(sorted_values, i, 2 * k);
+            m_keys[k] = sorted_values[i++];
+            i = fill(sorted_values, i, 2 * k + 1);
+        }
+        return i;
+    }
+
+    Key* m_keys;
+    size_t m_count;
+    size_t m_bytes;
+};
+
+template <typename Key>
+LookupIndex<Key>* create_eytzinger_index(const Key* sorted_values, uint32_t count) {
+    EytzingerIndex<Key>* index = new (std::nothrow) EytzingerIndex<Key>();
+    if (!index) {
+        return nullptr;
+    }
+
+    if (!index->build(sorted_values, count)) {
+        delete index;
+        return nullptr;
+    }
+
+    return index;
+}
+
+template <typename Key>
+LookupIndex<Key>* allocate_eytzinger_index(uint32_t count) {
+    EytzingerIndex<Key>* index = new (std::nothrow) EytzingerIndex<Key>();
+    if (!index) {
+        return nullptr;
+    }
+
+    if (!index->allocate(count)) {
+        delete index;
+        return nullptr;
+    }
+
+    return index;
+}
+
+#define INSTANTIATE(Key) \
+    template LookupIndex<Key>* create_eytzinger_index(const Key*, uint32_t); \
+    template LookupIndex<Key>* allocate_eytzinger_index<Key>(uint32_t);
+INSTANTIATE_KEY_TYPES(INSTANTIATE)
@@ -0,0 +1,245 @@
+// HashSetIndex.cpp
+#include "LookupIndex.h"
+#include <stdlib.h>
+#include <string.h>
+#include <new>
+
+#define GROUP_SIZE 16        // Control bytes compared per SSE2 probe
+#define CTRL_EMPTY 0x80      // High bit set marks a free slot
+#define MAX_LOAD_NUM 7       // Maximum load factor 7/8
+#define MAX_LOAD_DEN 8
+
+typedef char ctrl_vec_t __attribute__((vector_size(GROUP_SIZE)));
+
+// Bit i set where byte i of the group equals byte b
+static inline uint32_t match_byte(const uint8_t* group, uint8_t b) {
+    ctrl_vec_t ctrl = *(const ctrl_vec_t*)group;
+    ctrl_vec_t needle = (ctrl_vec_t){0} + (char)b;
+    return (uint32_t)__builtin_ia32_pmovmskb128(ctrl == needle);
+}
+
+// Open-addressing set in the style of SwissTable. Slots are split into groups
+// of 16; each slot has a control byte that is either CTRL_EMPTY or the low 7
+// bits of the value's hash. A probe compares a whole group of control bytes
+// with one vector compare and only reads the keys whose tag matched, so a
+// lookup normally touches one control line and one key line. The set is fixed
+// at build time, so hash_key needs no per-table seed.
+template <typename Key>
+class HashSetIndex : public LookupIndex<Key> {
+public:
+    HashSetIndex() : m_ctrl(nullptr), m_keys(nullptr), m_group_mask(0), m_bytes(0) {}
+
+    ~HashSetIndex() {
+        if (m_ctrl) {
+            memset(m_ctrl, 0, m_bytes);  // Secure cleanup
+            free(m_ctrl);
+        }
+    }
+
+    bool allocate(uint32_t count) {
+        size_t capacity = GROUP_SIZE;
+        while (capacity * MAX_LOAD_NUM / MAX_LOAD_DEN < count) {
+            capacity *= 2;
+        }
+
+        // Control bytes and keys share one allocation, keys starting on the
+        // first cache line after the control bytes
+        size_t ctrl_bytes = (capacity + CACHE_LINE_SIZE - 1) & ~(size_t)(CACHE_LINE_SIZE - 1);
+        m_bytes = ctrl_bytes + capacity * sizeof(Key);
+
+        void* ptr = NULL;
+        if (posix_memalign(&ptr, CACHE_LINE_SIZE, m_bytes) != 0) {
+            return false;
+        }
+        m_ctrl = (uint8_t*)ptr;
+        m_keys = (Key*)(m_ctrl + ctrl_bytes);
+        m_group_mask = capacity / GROUP_SIZE - 1;
+        return true;
+    }
+
+    bool build(const Key* values, uint32_t count) {
+        if (!allocate(count)) {
+            return false;
+        }
+
+        memset(m_ctrl, CTRL_EMPTY, (m_group_mask + 1) * GROUP_SIZE);
+        for (uint32_t i = 0; i < count; i++) {
+            insert(values[i]);
+        }
+        return true;
+    }
+
+    bool contains(Key value) const {
+        uint64_t h = hash_key(value);
+        uint8_t tag = (uint8_t)(h & 0x7F);
+        size_t group = (size_t)(h >> 7) & m_group_mask;
+
+        // Triangular probing visits every group when the count is a power of two
+        for (size_t step = 1; ; step++) {
+            const uint8_t* ctrl = m_ctrl + group * GROUP_SIZE;
+            const Key* keys = m_keys + group * GROUP_SIZE;
+
+            for (uint32_t hits = match_byte(ctrl, tag); hits; hits &= hits - 1) {
+                if (keys[__builtin_ctz(hits)] == value) {
+                    return true;
+                }
+            }
+
+            if (match_byte(ctrl, CTRL_EMPTY)) {
+                return false;
+            }
+            group = (group + step) & m_group_mask;
+        }
+    }
+
+    // A lookup in flight alternates between two steps, each ending with a
+    // prefetch and a switch to the next lookup: matching the tag against the
+    // group's control bytes, which prefetches the first matching key, and
+    // comparing the matching keys, which prefetches the next group's control
+    // bytes if the probe goes on. A finished lookup hands its slot to the
+    // next query.
+    void contains_batch(const Key* values, size_t count, uint8_t* bitmap) const {
+        Probe probes[LOOKUPS_IN_FLIGHT];
+        size_t active = 0;
+        size_t next = 0;
+        while (active < LOOKUPS_IN_FLIGHT && next < count) {
+            start_probe(probes[active++], values, next++);
+        }
+
+        while (active > 0) {
+            for (size_t s = 0; s < active; ) {
+                Probe& probe = probes[s];
+                const uint8_t* ctrl = m_ctrl + probe.group * GROUP_SIZE;
+                bool found = false;
+
+                if (probe.hits == 0) {
+                    probe.hits = match_byte(ctrl, probe.tag);
+                    if (probe.hits) {
+                        size_t slot = probe.group * GROUP_SIZE + __builtin_ctz(probe.hits);
+                        __builtin_prefetch(m_keys + slot);
+                        s++;
+                        continue;
+                    }
+                } else {
+                    const Key* keys = m_keys + probe.group * GROUP_SIZE;
+                    for (; probe.hits; probe.hits &= probe.hits - 1) {
+                        if (keys[__builtin_ctz(probe.hits)] == values[probe.query]) {
+                            found = true;
+                            break;
+                        }
+                    }
+                }
+
+                if (!found && !match_byte(ctrl, CTRL_EMPTY)) {
+                    probe.hits = 0;
+                    probe.group = (probe.group + probe.step++) & m_group_mask;
+                    __builtin_prefetch(m_ctrl + probe.group * GROUP_SIZE);
+                    s++;
+                    continue;
+                }
+
+                size_t i = probe.query;
+                bitmap[i >> 3] |= (uint8_t)(found << (i & 7));
+                if (next < count) {
+                    start_probe(probe, values, next++);
+                } else {
+                    probe = probes[--active];
+                }
+            }
+        }
+    }
+
+    size_t memory_bytes() const {
+        return m_bytes;
+    }
+
+    void* storage() {
+        return m_ctrl;
+    }
+
+private:
+    // One lookup of contains_batch
+    struct Probe {
+        size_t query;
+        size_t group;
+        size_t step;
+        uint32_t hits;  // Tag matches still to compare, 0 while matching tags
+        uint8_t tag;
+    };
+
+    void start_probe(Probe& probe, const Key* values, size_t query) const {
+        uint64_t h = hash_key(values[query]);
+        probe.query = query;
+        probe.tag = (uint8_t)(h & 0x7F);
+        probe.group = (size_t)(h >> 7) & m_group_mask;
+        probe.step = 1;
+        probe.hits = 0;
+        __builtin_prefetch(m_ctrl + probe.group * GROUP_SIZE);
+    }
+
+    void insert(Key value) {
+        uint64_t h = hash_key(value);
+        uint8_t tag = (uint8_t)(h & 0x7F);
+        size_t group = (size_t)(h >> 7) & m_group_mask;
+
+        for (size_t step = 1; ; step++) {
+            uint8_t* ctrl = m_ctrl + group * GROUP_SIZE;
+            Key* keys = m_keys + group * GROUP_SIZE;
+
+            for (uint32_t hits = match_byte(ctrl, tag); hits; hits &= hits - 1) {
+                if (keys[__builtin_ctz(hits)] == value) {
+                    return;  // Duplicate
+                }
+            }
+
+            uint32_t empty = match_byte(ctrl, CTRL_EMPTY);
+            if (empty) {
+                int slot = __builtin_ctz(empty);
+                ctrl[slot] = tag;
+                keys[slot] = value;
+                return;
+            }
+            group = (group + step) & m_group_mask;
+        }
+    }
+
+    uint8_t* m_ctrl;
+    Key* m_keys;
+    size_t m_group_mask;
+    size_t m_bytes;
+};
+
+template <typename Key>
+LookupIndex<Key>* create_hash_set_index(const Key* sorted_values, uint32_t count) {
+    HashSetIndex<Key>* index = new (std::nothrow) HashSetIndex<Key>();
+    if (!index) {
+        return nullptr;
+    }
+
+    if (!index->build(sorted_values, count)) {
+        delete index;
+        return nullptr;
+    }
+
+    return index;
+}
+
+template <typename Key>
+LookupIndex<Key>* allocate_hash_set_index(uint32_t count) {
+    HashSetIndex<Key>* index = new (std::nothrow) HashSetIndex<Key>();
+    if (!index) {
+        return nullptr;
+    }
+
+    if (!index->allocate(count)) {
+        delete index;
+        return nullptr;
+    }
+
+    return index;
+}
+
+#define INSTANTIATE(Key) \
+    template LookupIndex<Key>* create_hash_set_index(const Key*, uint32_t); \
+    template LookupIndex<Key>* allocate_hash_set_index<Key>(uint32_t);
+INSTANTIATE_KEY_TYPES(INSTANTIATE)
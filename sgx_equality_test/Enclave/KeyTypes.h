@@ -0,0 +1,69 @@
+// KeyTypes.h
+#ifndef _KEY_TYPES_H_
+#define _KEY_TYPES_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include "../common/shared_types.h"
+
+// The C++ type behind each KEY_TYPE_*. Sets, indexes and pending updates are
+// templates over it, so every width gets its own compares and kernels and the
+// 32-bit code is the same as before the other widths existed.
+template <typename Key> struct KeyType;
+template <> struct KeyType<int>      { static const uint32_t id = KEY_TYPE_INT32; };
+template <> struct KeyType<uint64_t> { static const uint32_t id = KEY_TYPE_UINT64; };
+template <> struct KeyType<Key128>   { static const uint32_t id = KEY_TYPE_DIGEST128; };
+
+// Calls function<Key> args, args being a parenthesized argument list, for
+// the Key of key_type; the type is resolved once per call, never per value.
+// All instantiations must return the same type.
+#define DISPATCH_KEY_TYPE(key_type, function, args) \
+    ((key_type) == KEY_TYPE_UINT64    ? function<uint64_t> args : \
+     (key_type) == KEY_TYPE_DIGEST128 ? function<Key128> args : \
+                                        function<int> args)
+
+// Expands INSTANTIATE(Key) for every key type, for templates defined in a
+// .cpp file
+#define INSTANTIATE_KEY_TYPES(INSTANTIATE) \
+    INSTANTIATE(int) \
+    INSTANTIATE(uint64_t) \
+    INSTANTIATE(Key128)
+
+// The top 64 bits of a key as an unsigned number in key order, so the gap
+// between two keys' prefixes measures the range between them
+static inline uint64_t key_prefix(int value) {
+    return (uint32_t)value ^ 0x80000000u;
+}
+
+static inline uint64_t key_prefix(uint64_t value) {
+    return value;
+}
+
+static inline uint64_t key_prefix(const Key128& value) {
+    return value.hi;
+}
+
+// Murmur3 finalizer; the hashed structures are built inside the enclave and
+// never leave it, so no seed is needed
+static inline uint64_t mix_hash(uint64_t h) {
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+    return h;
+}
+
+static inline uint64_t hash_key(int value) {
+    return mix_hash((uint32_t)value);
+}
+
+static inline uint64_t hash_key(uint64_t value) {
+    return mix_hash(value);
+}
+
+static inline uint64_t hash_key(const Key128& value) {
+    return mix_hash(value.hi ^ mix_hash(value.lo));
+}
+
+#endif // _KEY_TYPES_H_
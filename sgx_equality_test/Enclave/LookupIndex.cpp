@@ -0,0 +1,48 @@
+// LookupIndex.cpp
+#include "LookupIndex.h"
+#include "../common/shared_types.h"
+
+template <typename Key>
+LookupIndex<Key>* create_lookup_index(uint32_t engine, const Key* sorted_values, uint32_t count) {
+    if (!sorted_values || count == 0) {
+        return nullptr;
+    }
+
+    switch (engine) {
+        case LOOKUP_ENGINE_EYTZINGER:
+            return create_eytzinger_index(sorted_values, count);
+        case LOOKUP_ENGINE_HASH:
+            return create_hash_set_index(sorted_values, count);
+        case LOOKUP_ENGINE_PAGED:
+            return create_paged_index(sorted_values, count);
+        case LOOKUP_ENGINE_OBLIVIOUS:
+            return create_oblivious_scan_index(sorted_values, count);
+        case LOOKUP_ENGINE_ELIAS_FANO:
+            return create_elias_fano_index(sorted_values, count);
+        default:
+            return nullptr;
+    }
+}
+
+template <typename Key>
+LookupIndex<Key>* allocate_lookup_index(uint32_t engine, uint32_t count) {
+    if (count == 0) {
+        return nullptr;
+    }
+
+    switch (engine) {
+        case LOOKUP_ENGINE_EYTZINGER:
+            return allocate_eytzinger_index<Key>(count);
+        case LOOKUP_ENGINE_HASH:
+            return allocate_hash_set_index<Key>(count);
+        case LOOKUP_ENGINE_OBLIVIOUS:
+            return allocate_oblivious_scan_index<Key>(count);
+        default:
+            return nullptr;
+    }
+}
+
+#define INSTANTIATE(Key) \
+    template LookupIndex<Key>* create_lookup_index(uint32_t, const Key*, uint32_t); \
+    template LookupIndex<Key>* allocate_lookup_index<Key>(uint32_t, uint32_t);
+INSTANTIATE_KEY_TYPES(INSTANTIATE)
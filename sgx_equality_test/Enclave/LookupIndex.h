@@ -0,0 +1,97 @@
+// LookupIndex.h
+#ifndef _LOOKUP_INDEX_H_
+#define _LOOKUP_INDEX_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include "KeyTypes.h"
+
+#define CACHE_LINE_SIZE 64
+#define LOOKUPS_IN_FLIGHT 16  // Lookups contains_batch interleaves
+
+// The parts of a lookup index that do not depend on the key type, so a
+// snapshot can be restored into one before its keys are known
+class LookupIndexStorage {
+public:
+    virtual ~LookupIndexStorage() {}
+
+    // Bytes of enclave memory held by the index on top of the values
+    virtual size_t memory_bytes() const = 0;
+
+    // The index's single allocation, memory_bytes() long. Its layout depends
+    // only on the engine, the key type and the value count, so a copy saved
+    // from one index restores another allocated for the same three. nullptr
+    // for an index that is rebuilt from the values instead.
+    virtual void* storage() = 0;
+
+    // Whether the index keeps the sorted values itself, so the set can drop
+    // its own copy and read them back through read_values
+    virtual bool holds_values() const { return false; }
+};
+
+// Search structure built over the sorted secret values when they are loaded.
+// The linear engine has no index and scans the values directly.
+template <typename Key>
+class LookupIndex : public LookupIndexStorage {
+public:
+    virtual bool contains(Key value) const = 0;
+
+    // Sets bit i of the caller-zeroed bitmap for every values[i] in the
+    // index. Indexes whose lookups chase dependent cache misses override it
+    // to keep LOOKUPS_IN_FLIGHT lookups going at once, each a small state
+    // machine that prefetches its next line and yields to the others, so
+    // their misses overlap instead of following one another.
+    virtual void contains_batch(const Key* values, size_t count, uint8_t* bitmap) const {
+        for (size_t i = 0; i < count; i++) {
+            bitmap[i >> 3] |= (uint8_t)(contains(values[i]) << (i & 7));
+        }
+    }
+
+    // Position of value among the sorted values, or -1 if it is absent. Only
+    // indexes that hold the values implement it; for the others the set
+    // searches its own sorted array.
+    virtual int64_t find(Key value) const {
+        (void)value;
+        return -1;
+    }
+
+    // Copies count sorted values starting at first into out; false if the
+    // index does not hold the values or the range is out of bounds
+    virtual bool read_values(uint32_t first, uint32_t count, Key* out) const {
+        (void)first;
+        (void)count;
+        (void)out;
+        return false;
+    }
+};
+
+// Builds the index for the given engine from values sorted in ascending order.
+// Returns nullptr for LOOKUP_ENGINE_LINEAR or when allocation fails.
+template <typename Key>
+LookupIndex<Key>* create_lookup_index(uint32_t engine, const Key* sorted_values, uint32_t count);
+
+// Allocates an index for count values with uninitialized storage, to be filled
+// from a snapshot. Returns nullptr for LOOKUP_ENGINE_LINEAR, LOOKUP_ENGINE_PAGED
+// and LOOKUP_ENGINE_ELIAS_FANO, which have no storage to fill, or when
+// allocation fails.
+template <typename Key>
+LookupIndex<Key>* allocate_lookup_index(uint32_t engine, uint32_t count);
+
+template <typename Key>
+LookupIndex<Key>* create_eytzinger_index(const Key* sorted_values, uint32_t count);
+template <typename Key>
+LookupIndex<Key>* create_hash_set_index(const Key* sorted_values, uint32_t count);
+template <typename Key>
+LookupIndex<Key>* create_paged_index(const Key* sorted_values, uint32_t count);
+template <typename Key>
+LookupIndex<Key>* create_oblivious_scan_index(const Key* sorted_values, uint32_t count);
+template <typename Key>
+LookupIndex<Key>* create_elias_fano_index(const Key* sorted_values, uint32_t count);
+template <typename Key>
+LookupIndex<Key>* allocate_eytzinger_index(uint32_t count);
+template <typename Key>
+LookupIndex<Key>* allocate_hash_set_index(uint32_t count);
+template <typename Key>
+LookupIndex<Key>* allocate_oblivious_scan_index(uint32_t count);
+
+#endif // _LOOKUP_INDEX_H_
@@ -0,0 +1,227 @@
+// ObliviousScanIndex.cpp
+#include "LookupIndex.h"
+#include <stdlib.h>
+#include <string.h>
+#include <new>
+
+// One AVX2 compare where the enclave is built for it, else one SSE2 compare;
+// wider vectors without AVX2 would be split into scalar code
+#ifdef __AVX2__
+#define SCAN_LANES  8
+#else
+#define SCAN_LANES  4
+#endif
+#define SCAN_UNROLL 4   // Independent accumulators
+#define SCAN_PAD    32  // Padding granule, a multiple of every step so the
+                        // layout does not depend on the build
+typedef int scan_vec_t __attribute__((vector_size(SCAN_LANES * sizeof(int))));
+
+// Full scan whose running time and memory accesses depend only on the set
+// size: every lookup compares the query against every value with vector
+// compares, ORs the lane masks together and reduces them once at the end,
+// with no data-dependent branch anywhere.
+//
+// Keys wider than 32 bits are split into 32-bit words kept in separate
+// planes, word w of value i at plane w, slot i. A match is then the AND of
+// one 32-bit lane compare per plane, which SSE2 and AVX2 both do natively,
+// where 64-bit lane compares would fall back to scalar code on SSE2.
+//
+// The index keeps its own copy of the values, padded to a multiple of
+// SCAN_PAD with copies of the smallest one, which can only match a query that
+// is in the set anyway. Pending updates are scanned in full the same way, by
+// apply_delta, until they are compacted into the set.
+template <typename Key>
+class ObliviousScanIndex : public LookupIndex<Key> {
+public:
+    static const size_t KEY_WORDS = sizeof(Key) / sizeof(int);
+
+    ObliviousScanIndex() : m_words(nullptr), m_count(0), m_padded(0), m_bytes(0) {}
+
+    ~ObliviousScanIndex() {
+        if (m_words) {
+            memset(m_words, 0, m_bytes);  // Secure cleanup
+            free(m_words);
+        }
+    }
+
+    bool allocate(uint32_t count) {
+        m_padded = ((size_t)count + SCAN_PAD - 1) / SCAN_PAD * SCAN_PAD;
+        m_bytes = m_padded * sizeof(Key);
+
+        void* ptr = NULL;
+        if (posix_memalign(&ptr, CACHE_LINE_SIZE, m_bytes) != 0) {
+            return false;
+        }
+        m_words = (int*)ptr;
+        m_count = count;
+        return true;
+    }
+
+    bool build(const Key* sorted_values, uint32_t count) {
+        if (!allocate(count)) {
+            return false;
+        }
+
+        for (size_t i = 0; i < m_padded; i++) {
+            store(i, sorted_values[i < count ? i : 0]);
+        }
+        return true;
+    }
+
+    bool contains(Key value) const {
+        int words[KEY_WORDS];
+        memcpy(words, &value, sizeof(Key));
+        scan_vec_t needle[KEY_WORDS];
+        for (size_t w = 0; w < KEY_WORDS; w++) {
+            needle[w] = (scan_vec_t){0} + words[w];
+        }
+
+        scan_vec_t acc0 = (scan_vec_t){0};
+        scan_vec_t acc1 = (scan_vec_t){0};
+        scan_vec_t acc2 = (scan_vec_t){0};
+        scan_vec_t acc3 = (scan_vec_t){0};
+
+        for (size_t i = 0; i < m_padded / SCAN_LANES; i += SCAN_UNROLL) {
+            acc0 |= match(i, needle);
+            acc1 |= match(i + 1, needle);
+            acc2 |= match(i + 2, needle);
+            acc3 |= match(i + 3, needle);
+        }
+
+        scan_vec_t acc = acc0 | acc1 | acc2 | acc3;
+        int found = 0;
+        for (int lane = 0; lane < SCAN_LANES; lane++) {
+            found |= acc[lane];
+        }
+        return found != 0;
+    }
+
+    // Same scan as contains, also ORing together the positions of the
+    // matching slots, which gives the one position as long as the values are
+    // unique, as keyed sets' are. Padding slots are masked out.
+    int64_t find(Key value) const {
+        int words[KEY_WORDS];
+        memcpy(words, &value, sizeof(Key));
+        scan_vec_t needle[KEY_WORDS];
+        for (size_t w = 0; w < KEY_WORDS; w++) {
+            needle[w] = (scan_vec_t){0} + words[w];
+        }
+
+        scan_vec_t slot;
+        for (int lane = 0; lane < SCAN_LANES; lane++) {
+            slot[lane] = lane;
+        }
+        scan_vec_t limit = (scan_vec_t){0} + (int)m_count;
+        scan_vec_t found = (scan_vec_t){0};
+        scan_vec_t position = (scan_vec_t){0};
+
+        for (size_t i = 0; i < m_padded / SCAN_LANES; i++) {
+            scan_vec_t eq = match(i, needle) & (slot < limit);
+            found |= eq;
+            position |= eq & slot;
+            slot += SCAN_LANES;
+        }
+
+        int any = 0;
+        int result = 0;
+        for (int lane = 0; lane < SCAN_LANES; lane++) {
+            any |= found[lane];
+            result |= position[lane];
+        }
+        return any ? result : -1;
+    }
+
+    size_t memory_bytes() const {
+        return m_bytes;
+    }
+
+    void* storage() {
+        return m_words;
+    }
+
+    bool holds_values() const {
+        return true;
+    }
+
+    bool read_values(uint32_t first, uint32_t count, Key* out) const {
+        if (first > m_count || count > m_count - first) {
+            return false;
+        }
+        for (uint32_t i = 0; i < count; i++) {
+            out[i] = load(first + i);
+        }
+        return true;
+    }
+
+private:
+    // All-ones lanes where the values in vector block of every plane equal
+    // the needle's words
+    inline scan_vec_t match(size_t block, const scan_vec_t* needle) const {
+        const scan_vec_t* plane = (const scan_vec_t*)m_words;
+        size_t plane_blocks = m_padded / SCAN_LANES;
+        scan_vec_t eq = (plane[block] == needle[0]);
+#pragma GCC unroll 4
+        for (size_t w = 1; w < KEY_WORDS; w++) {
+            eq &= (plane[w * plane_blocks + block] == needle[w]);
+        }
+        return eq;
+    }
+
+    void store(size_t slot, Key value) {
+        int words[KEY_WORDS];
+        memcpy(words, &value, sizeof(Key));
+        for (size_t w = 0; w < KEY_WORDS; w++) {
+            m_words[w * m_padded + slot] = words[w];
+        }
+    }
+
+    Key load(size_t slot) const {
+        int words[KEY_WORDS];
+        for (size_t w = 0; w < KEY_WORDS; w++) {
+            words[w] = m_words[w * m_padded + slot];
+        }
+        Key value;
+        memcpy(&value, words, sizeof(Key));
+        return value;
+    }
+
+    int* m_words;  // KEY_WORDS planes of m_padded words
+    uint32_t m_count;
+    size_t m_padded;
+    size_t m_bytes;
+};
+
+template <typename Key>
+LookupIndex<Key>* create_oblivious_scan_index(const Key* sorted_values, uint32_t count) {
+    ObliviousScanIndex<Key>* index = new (std::nothrow) ObliviousScanIndex<Key>();
+    if (!index) {
+        return nullptr;
+    }
+
+    if (!index->build(sorted_values, count)) {
+        delete index;
+        return nullptr;
+    }
+
+    return index;
+}
+
+template <typename Key>
+LookupIndex<Key>* allocate_oblivious_scan_index(uint32_t count) {
+    ObliviousScanIndex<Key>* index = new (std::nothrow) ObliviousScanIndex<Key>();
+    if (!index) {
+        return nullptr;
+    }
+
+    if (!index->allocate(count)) {
+        delete index;
+        return nullptr;
+    }
+
+    return index;
+}
+
+#define INSTANTIATE(Key) \
+    template LookupIndex<Key>* create_oblivious_scan_index(const Key*, uint32_t); \
+    template LookupIndex<Key>* allocate_oblivious_scan_index<Key>(uint32_t);
+INSTANTIATE_KEY_TYPES(INSTANTIATE)
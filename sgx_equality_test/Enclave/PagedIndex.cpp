@@ -0,0 +1,256 @@
+// PagedIndex.cpp
+#include "LookupIndex.h"
+#include "Enclave_t.h"
+#include <sgx_trts.h>
+#include <sgx_tcrypto.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <new>
+
+#define PAGE_BYTES      4096  // Values decrypted whole on each lookup
+#define PAGE_KEY_SIZE   16
+#define PAGE_IV_SIZE    12
+#define PAGE_TAG_SIZE   16
+#define PAGE_STRIDE     (PAGE_TAG_SIZE + PAGE_BYTES)
+
+#define FILTER_BITS_PER_VALUE 8  // About 2% false positives with three probes
+#define FILTER_BLOCK_BITS     (CACHE_LINE_SIZE * 8)
+
+// Sorted values split into pages that are AES-GCM encrypted under a key drawn
+// for this index and kept in untrusted memory, so the set costs host RAM
+// rather than EPC. The enclave keeps only the first value of every page (the
+// fence keys) and a blocked Bloom filter: a lookup the filter rules out
+// touches no page, any other copies in, authenticates and searches the one
+// page its fence keys pick. The filter's byte per value dominates, so the
+// enclave keeps about 1/4 of a resident int set, 1/8 of a uint64 set and 1/16
+// of a digest128 set.
+//
+// The host sees which page each lookup fetches, and that a lookup fetched
+// none, so unlike the resident engines this one reveals each query's rough
+// rank in the set and a hint of whether it matched.
+template <typename Key>
+class PagedIndex : public LookupIndex<Key> {
+public:
+    static const uint32_t PAGE_VALUES = PAGE_BYTES / sizeof(Key);
+
+    PagedIndex() : m_summary(nullptr), m_fences(nullptr), m_filter(nullptr), m_pages(nullptr),
+                   m_count(0), m_page_count(0), m_filter_blocks(0), m_bytes(0) {}
+
+    ~PagedIndex() {
+        if (m_summary) {
+            memset(m_summary, 0, m_bytes);  // Secure cleanup
+            free(m_summary);
+        }
+        if (m_pages) {
+            ocall_free_untrusted(m_pages);
+        }
+        memset(m_key, 0, sizeof(m_key));
+    }
+
+    bool build(const Key* sorted_values, uint32_t count) {
+        m_count = count;
+        m_page_count = (count + PAGE_VALUES - 1) / PAGE_VALUES;
+        m_filter_blocks = ((size_t)count * FILTER_BITS_PER_VALUE + FILTER_BLOCK_BITS - 1) /
+                          FILTER_BLOCK_BITS;
+
+        // Filter blocks first so each stays on its own cache line
+        size_t fence_bytes = (size_t)m_page_count * sizeof(Key);
+        m_bytes = m_filter_blocks * CACHE_LINE_SIZE + fence_bytes;
+        m_bytes = (m_bytes + CACHE_LINE_SIZE - 1) & ~(size_t)(CACHE_LINE_SIZE - 1);
+
+        void* ptr = NULL;
+        if (posix_memalign(&ptr, CACHE_LINE_SIZE, m_bytes) != 0) {
+            return false;
+        }
+        m_summary = (uint8_t*)ptr;
+        memset(m_summary, 0, m_bytes);
+        m_filter = (uint64_t*)m_summary;
+        m_fences = (Key*)(m_summary + m_filter_blocks * CACHE_LINE_SIZE);
+
+        size_t pages_bytes = (size_t)m_page_count * PAGE_STRIDE;
+        void* pages = NULL;
+        if (ocall_alloc_untrusted(&pages, pages_bytes) != SGX_SUCCESS || !pages) {
+            return false;
+        }
+        m_pages = (uint8_t*)pages;
+        if (!sgx_is_outside_enclave(m_pages, pages_bytes) ||
+            sgx_read_rand(m_key, sizeof(m_key)) != SGX_SUCCESS) {
+            return false;
+        }
+
+        for (uint32_t i = 0; i < count; i++) {
+            add_to_filter(sorted_values[i]);
+        }
+
+        // Ciphertext is safe to write straight to untrusted memory
+        for (uint32_t page = 0; page < m_page_count; page++) {
+            const Key* values = sorted_values + (size_t)page * PAGE_VALUES;
+            m_fences[page] = values[0];
+
+            uint8_t iv[PAGE_IV_SIZE];
+            page_iv(page, iv);
+            uint8_t* slot = m_pages + (size_t)page * PAGE_STRIDE;
+            if (sgx_rijndael128GCM_encrypt((const sgx_aes_gcm_128bit_key_t*)m_key,
+                                           (const uint8_t*)values, page_bytes(page),
+                                           slot + PAGE_TAG_SIZE, iv, PAGE_IV_SIZE, NULL, 0,
+                                           (sgx_aes_gcm_128bit_tag_t*)slot) != SGX_SUCCESS) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    bool contains(Key value) const {
+        return find(value) >= 0;
+    }
+
+    int64_t find(Key value) const {
+        if (!filter_may_contain(value)) {
+            return -1;
+        }
+
+        // The page whose fence key is the last one not above value
+        uint32_t page = (uint32_t)(std::upper_bound(m_fences, m_fences + m_page_count, value) -
+                                   m_fences);
+        if (page == 0) {
+            return -1;
+        }
+        page--;
+
+        alignas(16) Key values[PAGE_VALUES];
+        uint32_t count = fetch_page(page, values);
+        const Key* found = std::lower_bound(values, values + count, value);
+        int64_t position = (found != values + count && *found == value) ?
+                           (int64_t)page * PAGE_VALUES + (found - values) : -1;
+        memset(values, 0, count * sizeof(Key));  // Secure cleanup
+        return position;
+    }
+
+    size_t memory_bytes() const {
+        return m_bytes;
+    }
+
+    // The pages are sealed to a key that dies with the index, so snapshots
+    // carry the values and a restore builds a fresh index
+    void* storage() {
+        return nullptr;
+    }
+
+    bool holds_values() const {
+        return true;
+    }
+
+    bool read_values(uint32_t first, uint32_t count, Key* out) const {
+        if (first > m_count || count > m_count - first) {
+            return false;
+        }
+
+        alignas(16) Key values[PAGE_VALUES];
+        while (count > 0) {
+            uint32_t page = first / PAGE_VALUES;
+            uint32_t offset = first % PAGE_VALUES;
+            uint32_t page_count = fetch_page(page, values);
+            uint32_t n = std::min(count, page_count - offset);
+            memcpy(out, values + offset, n * sizeof(Key));
+            out += n;
+            first += n;
+            count -= n;
+        }
+        memset(values, 0, sizeof(values));  // Secure cleanup
+        return true;
+    }
+
+private:
+    uint32_t page_bytes(uint32_t page) const {
+        uint32_t remaining = m_count - page * PAGE_VALUES;
+        return (remaining < PAGE_VALUES ? remaining : PAGE_VALUES) * sizeof(Key);
+    }
+
+    // Every page is encrypted once under a key fresh to this index, so its
+    // number is a unique IV and also ties its ciphertext to its slot
+    static void page_iv(uint32_t page, uint8_t* iv) {
+        memset(iv, 0, PAGE_IV_SIZE);
+        memcpy(iv, &page, sizeof(page));
+    }
+
+    // Copies the page in before decrypting it, so the host cannot change the
+    // ciphertext between authentication and use, and returns its value count.
+    // A page that fails authentication was tampered with by the host; no
+    // answer built on it can be trusted, so the enclave stops.
+    uint32_t fetch_page(uint32_t page, Key* values) const {
+        uint32_t bytes = page_bytes(page);
+        uint8_t sealed[PAGE_STRIDE];
+        memcpy(sealed, m_pages + (size_t)page * PAGE_STRIDE, PAGE_TAG_SIZE + bytes);
+
+        uint8_t iv[PAGE_IV_SIZE];
+        page_iv(page, iv);
+        if (sgx_rijndael128GCM_decrypt((const sgx_aes_gcm_128bit_key_t*)m_key,
+                                       sealed + PAGE_TAG_SIZE, bytes, (uint8_t*)values,
+                                       iv, PAGE_IV_SIZE, NULL, 0,
+                                       (const sgx_aes_gcm_128bit_tag_t*)sealed) != SGX_SUCCESS) {
+            abort();
+        }
+        return bytes / sizeof(Key);
+    }
+
+    // One cache line per value: the high hash bits pick the block, three
+    // 9-bit slices of the low bits pick the bits within it
+    uint64_t* filter_block(uint64_t h) const {
+        size_t block = (size_t)(((h >> 32) * m_filter_blocks) >> 32);
+        return m_filter + block * (CACHE_LINE_SIZE / sizeof(uint64_t));
+    }
+
+    void add_to_filter(Key value) {
+        uint64_t h = hash_key(value);
+        uint64_t* block = filter_block(h);
+        for (int i = 0; i < 3; i++) {
+            uint32_t bit = (uint32_t)(h >> (9 * i)) & (FILTER_BLOCK_BITS - 1);
+            block[bit / 64] |= 1ULL << (bit % 64);
+        }
+    }
+
+    bool filter_may_contain(Key value) const {
+        uint64_t h = hash_key(value);
+        const uint64_t* block = filter_block(h);
+        for (int i = 0; i < 3; i++) {
+            uint32_t bit = (uint32_t)(h >> (9 * i)) & (FILTER_BLOCK_BITS - 1);
+            if (!(block[bit / 64] & (1ULL << (bit % 64)))) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    uint8_t m_key[PAGE_KEY_SIZE];
+    uint8_t* m_summary;  // Filter blocks, then fence keys
+    Key* m_fences;
+    uint64_t* m_filter;
+    uint8_t* m_pages;    // Untrusted: per page a GCM tag, then the ciphertext
+    uint32_t m_count;
+    uint32_t m_page_count;
+    size_t m_filter_blocks;
+    size_t m_bytes;
+};
+
+template <typename Key>
+const uint32_t PagedIndex<Key>::PAGE_VALUES;
+
+template <typename Key>
+LookupIndex<Key>* create_paged_index(const Key* sorted_values, uint32_t count) {
+    PagedIndex<Key>* index = new (std::nothrow) PagedIndex<Key>();
+    if (!index) {
+        return nullptr;
+    }
+
+    if (!index->build(sorted_values, count)) {
+        delete index;
+        return nullptr;
+    }
+
+    return index;
+}
+
+#define INSTANTIATE(Key) \
+    template LookupIndex<Key>* create_paged_index(const Key*, uint32_t);
+INSTANTIATE_KEY_TYPES(INSTANTIATE)
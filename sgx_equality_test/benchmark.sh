@@ -3,6 +3,68 @@
 # Exit on any error
 set -e
 
+# With --service the enclave is created once per size by a long-running
+# sgx_equality_test --serve instance and every iteration only pays for its query.
+# With --switchless N every iteration is run a second time with N switchless
+# worker threads and both latencies are recorded.
+# With --threads N every local run splits its test values across N enclave threads.
+# With --oblivious every iteration is run a second time with the constant-time
+# oblivious engine and both latencies are recorded. The test value is never in
+# the set, so the first run shows the early-exit scan at its worst case.
+USE_SERVICE=0
+SWITCHLESS_WORKERS=0
+QUERY_THREADS=1
+USE_OBLIVIOUS=0
+while [ $# -gt 0 ]; do
+    case "$1" in
+        --service)
+            USE_SERVICE=1
+            shift
+            ;;
+        --switchless)
+            SWITCHLESS_WORKERS="$2"
+            shift 2
+            ;;
+        --threads)
+            QUERY_THREADS="$2"
+            shift 2
+            ;;
+        --oblivious)
+            USE_OBLIVIOUS=1
+            shift
+            ;;
+        *)
+            echo "Usage: $0 [--service] [--switchless N] [--threads N] [--oblivious]"
+            exit 1
+            ;;
+    esac
+done
+
+if [ $USE_SERVICE -eq 1 ] && [ "$SWITCHLESS_WORKERS" -gt 0 ]; then
+    echo "Error: --switchless is not supported together with --service"
+    exit 1
+fi
+if [ $USE_SERVICE -eq 1 ] && [ "$QUERY_THREADS" -gt 1 ]; then
+    echo "Error: --threads is not supported together with --service"
+    exit 1
+fi
+if [ $USE_OBLIVIOUS -eq 1 ] && { [ $USE_SERVICE -eq 1 ] || [ "$SWITCHLESS_WORKERS" -gt 0 ]; }; then
+    echo "Error: --oblivious is not supported together with --service or --switchless"
+    exit 1
+fi
+SOCKET_PATH="$(pwd)/sgx_equality_test.sock"
+SERVICE_PID=""
+SERVICE_START_TIMEOUT=300  # Seconds to wait for the service to load its set
+
+stop_service() {
+    if [ -n "$SERVICE_PID" ]; then
+        kill "$SERVICE_PID" 2>/dev/null || true
+        wait "$SERVICE_PID" 2>/dev/null || true
+        SERVICE_PID=""
+    fi
+}
+trap stop_service EXIT
+
 # Function to print with timestamp
 log() {
     echo "[$(date '+%Y-%m-%d %H:%M:%S')] $1"
@@ -18,7 +80,14 @@ mkdir -p "$RESULTS_DIR"
 
 # Create summary stats file
 SUMMARY_FILE="${RESULTS_DIR}/summary.csv"
-echo "Size,Avg_DecryptionTime_ms,Avg_IntersectionTime_ms,Avg_IntersectionResult,Avg_EncryptionTime_ms,Avg_TotalRuntime_ms" > "$SUMMARY_FILE"
+SUMMARY_HEADER="Size,Avg_DecryptionTime_ms,Avg_IntersectionTime_ms,Avg_IntersectionResult,Avg_EncryptionTime_ms,Avg_TotalRuntime_ms"
+if [ "$SWITCHLESS_WORKERS" -gt 0 ]; then
+    SUMMARY_HEADER="${SUMMARY_HEADER},Avg_Switchless_IntersectionTime_ms,Avg_Switchless_EncryptionTime_ms,Avg_Switchless_TotalRuntime_ms"
+fi
+if [ $USE_OBLIVIOUS -eq 1 ]; then
+    SUMMARY_HEADER="${SUMMARY_HEADER},Avg_Oblivious_IntersectionTime_ms,Avg_Oblivious_TotalRuntime_ms"
+fi
+echo "$SUMMARY_HEADER" > "$SUMMARY_FILE"
 
 # Clean and build the project
 log "Cleaning previous build..."
@@ -27,8 +96,8 @@ make clean
 log "Building project..."
 make
 
-# Initialize array of sizes (2^10 to 2^20)
-SIZES=(1024 2048 4096 8192 16384 32768 65536 131072 262144 524288 1048576)
+# Initialize array of sizes (2^10 to 2^21)
+SIZES=(1024 2048 4096 8192 16384 32768 65536 131072 262144 524288 1048576 2097152)
 
 # Run tests for each size
 for size in "${SIZES[@]}"; do
@@ -41,21 +110,57 @@ for size in "${SIZES[@]}"; do
     # Create detailed results file for this size
     DETAIL_FILE="${SIZE_DIR}/results.csv"
     touch "$DETAIL_FILE"
-    echo "Test,DecryptionTime_ms,IntersectionTime_ms,IntersectionResult,EncryptionTime_ms,TotalRuntime_ms" > "$DETAIL_FILE"
+    DETAIL_HEADER="Test,DecryptionTime_ms,IntersectionTime_ms,IntersectionResult,EncryptionTime_ms,TotalRuntime_ms"
+    if [ "$SWITCHLESS_WORKERS" -gt 0 ]; then
+        DETAIL_HEADER="${DETAIL_HEADER},Switchless_IntersectionTime_ms,Switchless_EncryptionTime_ms,Switchless_TotalRuntime_ms"
+    fi
+    if [ $USE_OBLIVIOUS -eq 1 ]; then
+        DETAIL_HEADER="${DETAIL_HEADER},Oblivious_IntersectionTime_ms,Oblivious_TotalRuntime_ms"
+    fi
+    echo "$DETAIL_HEADER" > "$DETAIL_FILE"
+
+    if [ $USE_SERVICE -eq 1 ]; then
+        log "Generating test file and starting service..."
+        ./generate_test_files.sh 1 $size
+        ./sgx_equality_test --serve "$SOCKET_PATH" > /dev/null &
+        SERVICE_PID=$!
+        # Wait for the socket, giving up if the service exits or takes too long
+        WAITED=0
+        while [ ! -S "$SOCKET_PATH" ]; do
+            if ! kill -0 "$SERVICE_PID" 2>/dev/null; then
+                wait "$SERVICE_PID" 2>/dev/null || true
+                SERVICE_PID=""
+                echo "Error: service exited before listening on $SOCKET_PATH"
+                exit 1
+            fi
+            if [ $WAITED -ge $((SERVICE_START_TIMEOUT * 10)) ]; then
+                echo "Error: service did not listen on $SOCKET_PATH within ${SERVICE_START_TIMEOUT}s"
+                exit 1
+            fi
+            sleep 0.1
+            WAITED=$((WAITED + 1))
+        done
+    fi
 
     # Run 50 iterations for each size
     for i in {1..50}; do
         log "Running iteration $i of 50..."
 
-        # Generate test file with single value for this iteration
-        log "Generating test file..."
-        ./generate_test_files.sh 1 $size
+        if [ $USE_SERVICE -eq 0 ]; then
+            # Generate test file with single value for this iteration
+            log "Generating test file..."
+            ./generate_test_files.sh 1 $size
+        fi
 
         # Measure start time
         MAIN_START=$(date +%s.%N)
 
         # Run the test and capture output
-        MAIN_OUTPUT=$(./sgx_equality_test 1 | tail -n 1)
+        if [ $USE_SERVICE -eq 1 ]; then
+            MAIN_OUTPUT=$(./sgx_equality_test --connect "$SOCKET_PATH" 1 | tail -n 1)
+        else
+            MAIN_OUTPUT=$(./sgx_equality_test --threads "$QUERY_THREADS" 1 | tail -n 1)
+        fi
 
         # Measure end time
         MAIN_END=$(date +%s.%N)
@@ -64,17 +169,46 @@ for size in "${SIZES[@]}"; do
         TOTAL_TIME=$(echo "$MAIN_END - $MAIN_START" | bc | awk '{printf "%.3f", $1 * 1000}')
 
         # Parse the original output for other metrics
-        IFS=',' read -r test matches nonmatches errors totaltime processtime enctime dectime overhead pagefaults <<< "$MAIN_OUTPUT"
+        IFS=',' read -r test matches nonmatches errors totaltime processtime enctime dectime overhead pagefaults buildtime indexmem <<< "$MAIN_OUTPUT"
 
         # Convert other times from microseconds to milliseconds
         dec_ms=$(echo "scale=3; $dectime/1000" | bc)
         proc_ms=$(echo "scale=3; $processtime/1000" | bc)
         enc_ms=$(echo "scale=3; $enctime/1000" | bc)
 
+        DETAIL_ROW="$i,$dec_ms,$proc_ms,$matches,$enc_ms,$TOTAL_TIME"
+
+        # Repeat the same query with switchless calls enabled
+        if [ "$SWITCHLESS_WORKERS" -gt 0 ]; then
+            SL_START=$(date +%s.%N)
+            SL_OUTPUT=$(./sgx_equality_test --threads "$QUERY_THREADS" --switchless-workers "$SWITCHLESS_WORKERS" 1 | tail -n 1)
+            SL_END=$(date +%s.%N)
+            SL_TOTAL_TIME=$(echo "$SL_END - $SL_START" | bc | awk '{printf "%.3f", $1 * 1000}')
+
+            IFS=',' read -r _ _ _ _ _ sl_processtime sl_enctime _ <<< "$SL_OUTPUT"
+            sl_proc_ms=$(echo "scale=3; $sl_processtime/1000" | bc)
+            sl_enc_ms=$(echo "scale=3; $sl_enctime/1000" | bc)
+            DETAIL_ROW="${DETAIL_ROW},$sl_proc_ms,$sl_enc_ms,$SL_TOTAL_TIME"
+        fi
+
+        # Repeat the same query against the oblivious engine
+        if [ $USE_OBLIVIOUS -eq 1 ]; then
+            OB_START=$(date +%s.%N)
+            OB_OUTPUT=$(./sgx_equality_test --threads "$QUERY_THREADS" --engine oblivious 1 | tail -n 1)
+            OB_END=$(date +%s.%N)
+            OB_TOTAL_TIME=$(echo "$OB_END - $OB_START" | bc | awk '{printf "%.3f", $1 * 1000}')
+
+            IFS=',' read -r _ _ _ _ _ ob_processtime _ <<< "$OB_OUTPUT"
+            ob_proc_ms=$(echo "scale=3; $ob_processtime/1000" | bc)
+            DETAIL_ROW="${DETAIL_ROW},$ob_proc_ms,$OB_TOTAL_TIME"
+        fi
+
         # Write to detail file with measured total time
-        echo "$i,$dec_ms,$proc_ms,$matches,$enc_ms,$TOTAL_TIME" >> "$DETAIL_FILE"
+        echo "$DETAIL_ROW" >> "$DETAIL_FILE"
     done
 
+    stop_service
+
     # Calculate averages for summary
     log "Calculating averages..."
     avg_dec_ms=$(awk -F',' 'NR>1 {sum+=$2} END {printf "%.3f", sum/(NR-1)}' "$DETAIL_FILE")
@@ -83,8 +217,22 @@ for size in "${SIZES[@]}"; do
     avg_enc_ms=$(awk -F',' 'NR>1 {sum+=$5} END {printf "%.3f", sum/(NR-1)}' "$DETAIL_FILE")
     avg_total_ms=$(awk -F',' 'NR>1 {sum+=$6} END {printf "%.3f", sum/(NR-1)}' "$DETAIL_FILE")
 
+    SUMMARY_ROW="$size,$avg_dec_ms,$avg_proc_ms,$avg_matches,$avg_enc_ms,$avg_total_ms"
+    if [ "$SWITCHLESS_WORKERS" -gt 0 ]; then
+        for column in 7 8 9; do
+            avg=$(awk -F',' -v c=$column 'NR>1 {sum+=$c} END {printf "%.3f", sum/(NR-1)}' "$DETAIL_FILE")
+            SUMMARY_ROW="${SUMMARY_ROW},$avg"
+        done
+    fi
+    if [ $USE_OBLIVIOUS -eq 1 ]; then
+        for column in 7 8; do
+            avg=$(awk -F',' -v c=$column 'NR>1 {sum+=$c} END {printf "%.3f", sum/(NR-1)}' "$DETAIL_FILE")
+            SUMMARY_ROW="${SUMMARY_ROW},$avg"
+        done
+    fi
+
     # Add to summary file
-    echo "$size,$avg_dec_ms,$avg_proc_ms,$avg_matches,$avg_enc_ms,$avg_total_ms" >> "$SUMMARY_FILE"
+    echo "$SUMMARY_ROW" >> "$SUMMARY_FILE"
 
     log "Completed test for size $size"
     log "----------------------------------------"
@@ -7,6 +7,138 @@
 #define MAX_VALUES 2097152  // 2^21
 #define CURRENT_VERSION 1
 
+// Secret sets resident in the enclave at once, each loaded and queried under
+// a host-chosen id. Loading another evicts the least recently used, as does
+// exceeding ecall_set_memory_budget; ecalls on an evicted or never loaded id
+// fail with SGX_ERROR_INVALID_STATE.
+#define MAX_SECRET_SETS 16
+
+// Width of the values in a secret set file, query file or update, recorded
+// in the upper half of the 32-bit version word. Files that predate the field
+// carry 0 there and read unchanged as 32-bit sets.
+#define KEY_TYPE_INT32     0  // int
+#define KEY_TYPE_UINT64    1  // 64-bit identifiers
+#define KEY_TYPE_DIGEST128 2  // 128-bit digests such as hashed emails, as a Key128
+#define KEY_TYPE_COUNT     3
+#define KEY_TYPE_SIZE(key_type) \
+    ((size_t)((key_type) == KEY_TYPE_UINT64 ? 8 : (key_type) == KEY_TYPE_DIGEST128 ? 16 : 4))
+
+// Ordered by hi, then lo
+struct Key128 {
+    uint64_t hi;
+    uint64_t lo;
+};
+
+inline bool operator==(const Key128& a, const Key128& b) {
+    return ((a.hi ^ b.hi) | (a.lo ^ b.lo)) == 0;
+}
+
+inline bool operator!=(const Key128& a, const Key128& b) {
+    return !(a == b);
+}
+
+inline bool operator<(const Key128& a, const Key128& b) {
+    return a.hi < b.hi || (a.hi == b.hi && a.lo < b.lo);
+}
+
+inline bool operator>(const Key128& a, const Key128& b) {
+    return b < a;
+}
+
+// Lookup engines selectable through ecall_set_lookup_engine
+#define LOOKUP_ENGINE_LINEAR     0  // Early-exit scan over SecretData::values
+#define LOOKUP_ENGINE_EYTZINGER  1  // Cache-line blocked Eytzinger search
+#define LOOKUP_ENGINE_HASH       2  // SIMD-probed open-addressing hash set
+#define LOOKUP_ENGINE_PAGED      3  // Encrypted pages in untrusted memory behind fence keys and a filter
+#define LOOKUP_ENGINE_OBLIVIOUS  4  // Branchless full vector scan, constant time per lookup
+#define LOOKUP_ENGINE_ELIAS_FANO 5  // Elias-Fano compressed values, searched without decoding
+#define LOOKUP_ENGINE_COUNT      6
+#define LOOKUP_ENGINE_AUTO       0xFF  // Per set, the fastest calibrated engine within the memory budget
+
+// One candidate engine measured by LOOKUP_ENGINE_AUTO while loading a set
+struct EngineCalibration {
+    uint32_t engine;         // LOOKUP_ENGINE_*
+    uint32_t fits_budget;    // 1 if the set fits the memory budget with it, else 0
+    uint64_t memory_bytes;   // Enclave memory of the set with it
+    uint64_t build_time_us;
+    uint64_t lookup_ns;      // Mean over the calibration lookups
+};
+
+// Engine a loaded set's index was built for, returned by ecall_get_engine_report
+struct EngineReport {
+    uint32_t engine;           // LOOKUP_ENGINE_*, never LOOKUP_ENGINE_AUTO
+    uint32_t candidate_count;  // Calibrated candidates; 0 unless chosen by LOOKUP_ENGINE_AUTO
+    EngineCalibration candidates[LOOKUP_ENGINE_COUNT];
+};
+
+// Strategies for ecall_check_numbers_batch, selected through ecall_set_batch_mode
+#define BATCH_MODE_LOOKUP      0  // One lookup per query through the selected engine
+#define BATCH_MODE_MERGE       1  // Sort the queries and gallop through the sorted set
+#define BATCH_MODE_INTERLEAVED 2  // Several engine lookups in flight at once, overlapping their misses
+#define BATCH_MODE_COUNT       3
+
+// Encrypted result bitmap returned by the batched ecalls: a random AES-GCM IV,
+// the GCM tag, then one bit per query (bit i%8 of byte i/8 set on a match)
+#define RESULT_IV_SIZE     12
+#define RESULT_TAG_SIZE    16
+#define RESULT_HEADER_SIZE (RESULT_IV_SIZE + RESULT_TAG_SIZE)
+#define RESULT_BITMAP_BYTES(count) (((size_t)(count) + 7) / 8)
+#define RESULT_BUFFER_SIZE(count)  (RESULT_HEADER_SIZE + RESULT_BITMAP_BYTES(count))
+
+// What the batched ecalls return, selected through ecall_set_result_mode. The
+// summary modes replace the bitmap with a single encrypted ResultSummary
+// behind the same IV and tag, computed in the same pass as the lookups, so
+// their result size does not grow with the query count.
+#define RESULT_MODE_BITMAP      0  // One bit per query
+#define RESULT_MODE_CARDINALITY 1  // How many of the queries are in the set
+#define RESULT_MODE_THRESHOLD   2  // Whether that many reach the threshold
+#define RESULT_MODE_COUNT       3
+
+struct ResultSummary {
+    uint32_t mode;   // RESULT_MODE_CARDINALITY or RESULT_MODE_THRESHOLD
+    uint32_t value;  // Matching queries, or 1 if they reached the threshold and 0 if not
+};
+
+#define RESULT_SUMMARY_SIZE (RESULT_HEADER_SIZE + sizeof(ResultSummary))
+#define RESULT_MODE_SIZE(mode, count) \
+    ((mode) == RESULT_MODE_BITMAP ? RESULT_BUFFER_SIZE(count) : RESULT_SUMMARY_SIZE)
+
+// Encrypted result of ecall_lookup_payloads against a keyed set: the result
+// bitmap followed by one payload per query, 0 where the query is not in the
+// set, under a single IV and tag
+#define PAYLOAD_RESULT_SIZE(count) (RESULT_BUFFER_SIZE(count) + (size_t)(count) * PAYLOAD_SIZE)
+
+// A secret set file holds a SecretDataHeader and its first count values;
+// anything past them is ignored. It is streamed into the enclave through
+// ecall_begin/append/commit_secret_data at most INGEST_CHUNK_VALUES at a time.
+//
+// A keyed set file (version SECRET_DATA_VERSION_KEYED, written by value_sealer
+// seal-keyed) follows the values with count payloads, payloads[i] belonging
+// to values[i]. Its values must be unique, and it takes no incremental updates.
+#define SECRET_DATA_VERSION_KEYED 2
+#define PAYLOAD_SIZE              sizeof(uint32_t)
+#define SECRET_DATA_HEADER_SIZE sizeof(SecretDataHeader)
+#define SECRET_DATA_SIZE(count, key_type) \
+    (SECRET_DATA_HEADER_SIZE + (size_t)(count) * KEY_TYPE_SIZE(key_type))
+#define KEYED_SECRET_DATA_SIZE(count, key_type) \
+    (SECRET_DATA_SIZE(count, key_type) + (size_t)(count) * PAYLOAD_SIZE)
+#define INGEST_CHUNK_VALUES     65536
+
+// An unkeyed set may instead arrive as up to MAX_SECRET_SHARDS shard files,
+// each a secret set file of the same key type with its values sorted, as
+// value_sealer seal writes them. ecall_begin_secret_shards reserves the set,
+// ecall_ingest_secret_shard copies in each shard, concurrently on separate TCS
+// slots, and ecall_commit_secret_shards merges them in one pass, dropping
+// values found in more than one shard, and builds the index.
+#define MAX_SECRET_SHARDS 64
+
+struct SecretDataHeader {
+    uint16_t version;   // CURRENT_VERSION, or SECRET_DATA_VERSION_KEYED with payloads
+    uint16_t key_type;  // KEY_TYPE_*
+    uint32_t count;
+};
+
+// Whole 32-bit secret set image, as loaded by ecall_initialize_secret_data
 struct SecretData {
     uint32_t version;
     uint32_t count;
@@ -19,4 +151,80 @@ struct TestData {
     int values[MAX_VALUES];
 };
 
+// Compact query file written by value_sealer seal-tests: a QueryFileHeader, then
+// QUERY_CHUNK_COUNT chunks of a random AES-GCM IV, the GCM tag and up to
+// chunk_values encrypted values. Each chunk is authenticated on its own with
+// the header and its chunk index as AAD, so chunks can be decrypted and
+// checked one at a time but cannot be dropped, reordered or moved between files.
+#define QUERY_FILE_MAGIC        0x59524551  // "QERY"
+#define QUERY_CHUNK_IV_SIZE     12
+#define QUERY_CHUNK_TAG_SIZE    16
+#define QUERY_CHUNK_HEADER_SIZE (QUERY_CHUNK_IV_SIZE + QUERY_CHUNK_TAG_SIZE)
+#define QUERY_CHUNK_VALUES      16384  // Written by value_sealer
+#define QUERY_MAX_CHUNK_VALUES  65536
+
+struct QueryFileHeader {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t key_type;      // KEY_TYPE_*, matching the set queried or updated
+    uint32_t count;         // Query values in the file, at most MAX_VALUES
+    uint32_t chunk_values;  // Values per chunk, a multiple of 8; the last may be shorter
+};
+
+#define QUERY_CHUNK_COUNT(count, chunk_values) \
+    (((size_t)(count) + (chunk_values) - 1) / (chunk_values))
+#define QUERY_FILE_SIZE(count, chunk_values, key_type) \
+    (sizeof(QueryFileHeader) + QUERY_CHUNK_COUNT(count, chunk_values) * QUERY_CHUNK_HEADER_SIZE + \
+     (size_t)(count) * KEY_TYPE_SIZE(key_type))
+
+// Sealed snapshot of a loaded set, written by ecall_export_index_snapshot and
+// restored by ecall_import_index_snapshot. The sorted values, the payloads of
+// a keyed set and then the built index storage are cut into chunks of at most
+// SNAPSHOT_CHUNK_BYTES, no chunk spanning two of them, and each chunk is sealed on its own with an
+// IndexSnapshotHeader as its authenticated additional text. The snapshot file
+// is the chunk count followed by each sealed chunk prefixed with its size.
+// Every chunk carries the random id of the set version it was taken from, so
+// chunks of two snapshots cannot be spliced into one even when their headers
+// otherwise match.
+#define SNAPSHOT_MAGIC            0x50534e53  // "SNSP"
+#define SNAPSHOT_CHUNK_BYTES      (1024 * 1024)
+#define SNAPSHOT_SEAL_OVERHEAD    1024  // Bound on the sealing header plus additional text
+#define SNAPSHOT_SEALED_CHUNK_MAX (SNAPSHOT_CHUNK_BYTES + SNAPSHOT_SEAL_OVERHEAD)
+
+struct IndexSnapshotHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t engine;       // Lookup engine the index was built for
+    uint32_t count;        // Secret values
+    uint64_t index_bytes;  // Index storage following the values, 0 for linear
+    uint32_t chunk;        // Position of this chunk
+    uint32_t chunk_count;
+    uint64_t generation;   // Delta log generation the snapshot starts
+    uint32_t key_type;     // KEY_TYPE_* of the values
+    uint32_t keyed;        // 1 if a chunked payload array follows the values, else 0
+    uint64_t snapshot_id;  // Random per set version, the same in all its chunks
+};
+
+// Incremental updates (ecall_update_secret_set) carry their values as a
+// compact query file. Each applied batch comes back as a record sealed with a
+// DeltaRecordHeader as its additional text and the batch values as its text.
+// The delta log is the snapshot's append-only list of such records, each
+// prefixed with its size; a log only replays onto the snapshot whose
+// generation it carries, in sequence order.
+#define UPDATE_INSERT 0
+#define UPDATE_DELETE 1
+#define UPDATE_OP_COUNT 2
+
+#define DELTA_MAGIC 0x544c4544  // "DELT"
+#define DELTA_RECORD_SIZE_MAX(count, key_type) \
+    ((size_t)(count) * KEY_TYPE_SIZE(key_type) + SNAPSHOT_SEAL_OVERHEAD)
+
+struct DeltaRecordHeader {
+    uint32_t magic;
+    uint32_t op;           // UPDATE_INSERT or UPDATE_DELETE
+    uint64_t generation;   // Base set the record applies to
+    uint32_t sequence;     // Position in the log, from 0
+    uint32_t count;        // Values in the record, of the set's key type
+};
+
 #endif // _SHARED_TYPES_H_
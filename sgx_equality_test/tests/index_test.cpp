@@ -0,0 +1,245 @@
+// index_test.cpp
+// Differential test of the enclave's lookup indexes, pending-update sets and
+// bulk intersection against std::binary_search over the same sorted values.
+// None of them needs the SGX SDK, so this builds and runs on the host.
+#include "LookupIndex.h"
+#include "DeltaSet.h"
+#include "BulkIntersect.h"
+#include <algorithm>
+#include <random>
+#include <vector>
+#include <stdio.h>
+#include <string.h>
+
+#define QUERIES_PER_SET 20000
+
+static std::mt19937_64 g_rng(42);
+static int g_failures = 0;
+
+static void fail(const char* what, const char* key_name, size_t count, const char* detail) {
+    printf("FAIL %s<%s> over %zu values: %s\n", what, key_name, count, detail);
+    g_failures++;
+}
+
+// Random keys of each type, spread over the whole key space or packed into a
+// range a few times the count, plus the extremes of the type
+template <typename Key> struct TestKeys;
+
+template <> struct TestKeys<int> {
+    static const char* name() { return "int"; }
+    static int random(bool dense, size_t count) {
+        return dense ? (int)(g_rng() % (count * 3 + 1)) : (int)(uint32_t)g_rng();
+    }
+    static int lowest() { return INT32_MIN; }
+    static int highest() { return INT32_MAX; }
+};
+
+template <> struct TestKeys<uint64_t> {
+    static const char* name() { return "uint64"; }
+    static uint64_t random(bool dense, size_t count) {
+        return dense ? g_rng() % (count * 3 + 1) : g_rng();
+    }
+    static uint64_t lowest() { return 0; }
+    static uint64_t highest() { return UINT64_MAX; }
+};
+
+template <> struct TestKeys<Key128> {
+    static const char* name() { return "digest128"; }
+    static Key128 random(bool dense, size_t count) {
+        Key128 key = {dense ? g_rng() % (count * 3 + 1) : g_rng(), dense ? g_rng() % 4 : g_rng()};
+        return key;
+    }
+    static Key128 lowest() { Key128 key = {0, 0}; return key; }
+    static Key128 highest() { Key128 key = {UINT64_MAX, UINT64_MAX}; return key; }
+};
+
+template <typename Key>
+static std::vector<Key> sorted_keys(size_t count, bool dense) {
+    std::vector<Key> values;
+    while (values.size() < count) {
+        values.push_back(TestKeys<Key>::random(dense, count));
+    }
+    std::sort(values.begin(), values.end());
+    values.erase(std::unique(values.begin(), values.end()), values.end());
+    return values;
+}
+
+// Queries hitting the set half the time, plus the extremes of the type
+template <typename Key>
+static std::vector<Key> test_queries(const std::vector<Key>& values, bool dense) {
+    std::vector<Key> queries;
+    queries.push_back(TestKeys<Key>::lowest());
+    queries.push_back(TestKeys<Key>::highest());
+    while (queries.size() < QUERIES_PER_SET) {
+        queries.push_back((queries.size() & 1) ? values[g_rng() % values.size()] :
+                                                 TestKeys<Key>::random(dense, values.size()));
+    }
+    return queries;
+}
+
+template <typename Key>
+struct Engine {
+    const char* name;
+    LookupIndex<Key>* (*create)(const Key*, uint32_t);
+};
+
+template <typename Key>
+static void check_engine(const Engine<Key>& engine, const std::vector<Key>& values,
+                         const std::vector<Key>& queries) {
+    const char* key_name = TestKeys<Key>::name();
+    LookupIndex<Key>* index = engine.create(values.data(), (uint32_t)values.size());
+    if (!index) {
+        fail(engine.name, key_name, values.size(), "build failed");
+        return;
+    }
+
+    size_t mismatches = 0;
+    for (const Key& query : queries) {
+        if (index->contains(query) != std::binary_search(values.begin(), values.end(), query)) {
+            mismatches++;
+        }
+    }
+    if (mismatches) {
+        char detail[64];
+        snprintf(detail, sizeof(detail), "%zu contains mismatches", mismatches);
+        fail(engine.name, key_name, values.size(), detail);
+    }
+
+    // Batches shorter and longer than LOOKUPS_IN_FLIGHT, at odd offsets
+    const size_t batch_sizes[] = {1, LOOKUPS_IN_FLIGHT - 1, LOOKUPS_IN_FLIGHT + 3, 4099};
+    size_t first = 0;
+    for (size_t batch_size : batch_sizes) {
+        std::vector<uint8_t> bitmap((batch_size + 7) / 8, 0);
+        index->contains_batch(queries.data() + first, batch_size, bitmap.data());
+        for (size_t i = 0; i < batch_size; i++) {
+            bool expected = std::binary_search(values.begin(), values.end(), queries[first + i]);
+            if (((bitmap[i >> 3] >> (i & 7)) & 1) != expected) {
+                fail(engine.name, key_name, values.size(), "contains_batch mismatch");
+                break;
+            }
+        }
+        first += batch_size;
+    }
+    delete index;
+}
+
+template <typename Key>
+static void check_bulk_intersect(const std::vector<Key>& values, const std::vector<Key>& queries) {
+    std::vector<uint8_t> bitmap((queries.size() + 7) / 8, 0);
+    if (!bulk_intersect(values.data(), (uint32_t)values.size(), queries.data(), queries.size(),
+                        bitmap.data())) {
+        fail("bulk_intersect", TestKeys<Key>::name(), values.size(), "allocation failed");
+        return;
+    }
+
+    for (size_t i = 0; i < queries.size(); i++) {
+        bool expected = std::binary_search(values.begin(), values.end(), queries[i]);
+        if (((bitmap[i >> 3] >> (i & 7)) & 1) != expected) {
+            fail("bulk_intersect", TestKeys<Key>::name(), values.size(), "bitmap mismatch");
+            return;
+        }
+    }
+}
+
+// Inserts the values in sorted batches, then erases every other batch
+template <typename Key>
+static void check_delta_set(const std::vector<Key>& values) {
+    const size_t batch = 37;
+    DeltaSet<Key> delta;
+    for (size_t first = 0; first < values.size(); first += batch) {
+        uint32_t count = (uint32_t)std::min(batch, values.size() - first);
+        if (!delta.insert_sorted(values.data() + first, count)) {
+            fail("DeltaSet", TestKeys<Key>::name(), values.size(), "insert failed");
+            return;
+        }
+    }
+    for (size_t first = 0; first < values.size(); first += 2 * batch) {
+        delta.erase_sorted(values.data() + first, (uint32_t)std::min(batch, values.size() - first));
+    }
+
+    for (size_t i = 0; i < values.size(); i++) {
+        bool expected = (i / batch) % 2 == 1;
+        if (delta.contains(values[i]) != expected || delta.scan_contains(values[i]) != expected) {
+            fail("DeltaSet", TestKeys<Key>::name(), values.size(), "membership mismatch");
+            return;
+        }
+    }
+    if (!std::is_sorted(delta.values(), delta.values() + delta.size())) {
+        fail("DeltaSet", TestKeys<Key>::name(), values.size(), "values not sorted");
+    }
+}
+
+// A dense set stores no low bits, so every prefix from the largest value's up
+// to 2^64 - 1 must miss without reaching past the upper bits
+template <typename Key>
+static void check_elias_fano_top(const std::vector<Key>& values, const std::vector<Key>& queries) {
+    LookupIndex<Key>* index = create_elias_fano_index(values.data(), (uint32_t)values.size());
+    if (!index) {
+        fail("elias-fano", TestKeys<Key>::name(), values.size(), "build failed");
+        return;
+    }
+    for (const Key& query : queries) {
+        if (index->contains(query)) {
+            fail("elias-fano", TestKeys<Key>::name(), values.size(), "prefix near 2^64 found");
+            break;
+        }
+    }
+    delete index;
+}
+
+static void check_elias_fano_near_wrap() {
+    std::vector<uint64_t> ids;
+    std::vector<Key128> digests;
+    for (uint64_t i = 0; i < 1000; i++) {
+        ids.push_back(i);
+        Key128 digest = {i, i};
+        digests.push_back(digest);
+    }
+
+    std::vector<uint64_t> id_queries;
+    std::vector<Key128> digest_queries;
+    for (uint64_t back = 0; back <= 2000; back++) {
+        id_queries.push_back(UINT64_MAX - back);
+        Key128 digest = {UINT64_MAX - back, back};
+        digest_queries.push_back(digest);
+    }
+    check_elias_fano_top(ids, id_queries);
+    check_elias_fano_top(digests, digest_queries);
+}
+
+template <typename Key>
+static void check_key_type() {
+    const Engine<Key> engines[] = {
+        {"eytzinger", create_eytzinger_index<Key>},
+        {"hash", create_hash_set_index<Key>},
+        {"oblivious", create_oblivious_scan_index<Key>},
+        {"elias-fano", create_elias_fano_index<Key>},
+    };
+    const size_t sizes[] = {1, 2, 3, 15, 16, 17, 100, 1000, 4097, 50000};
+
+    for (size_t size : sizes) {
+        for (int dense = 0; dense < 2; dense++) {
+            std::vector<Key> values = sorted_keys<Key>(size, dense != 0);
+            std::vector<Key> queries = test_queries(values, dense != 0);
+            for (const Engine<Key>& engine : engines) {
+                check_engine(engine, values, queries);
+            }
+            check_bulk_intersect(values, queries);
+            check_delta_set(values);
+        }
+    }
+}
+
+int main() {
+    check_key_type<int>();
+    check_key_type<uint64_t>();
+    check_key_type<Key128>();
+    check_elias_fano_near_wrap();
+
+    if (g_failures) {
+        printf("%d checks failed\n", g_failures);
+        return 1;
+    }
+    printf("All index checks passed\n");
+    return 0;
+}
@@ -7,6 +7,10 @@
 #include <cstdint>
 #include <memory>
 #include <sstream>
+#include <cstring>
+#include <cerrno>
+#include <cstdlib>
+#include <cctype>
 #include <openssl/evp.h>
 #include <openssl/rand.h>
 #include <openssl/aes.h>
@@ -16,16 +20,77 @@
 #define AES_BLOCK_SIZE 16
 
 void print_usage() {
-    std::cout << "Usage: value_sealer [seal|seal-tests] output_file input_file\n";
+    std::cout << "Usage: value_sealer [--key-type TYPE] [seal|seal-keyed|seal-tests] output_file input_file\n";
     std::cout << "  seal       - Seal secret values to a file\n";
-    std::cout << "  seal-tests - Seal and encrypt test values to a file\n";
+    std::cout << "  seal-keyed - Seal secret values with a payload each, read as 'value payload'\n";
+    std::cout << "               lines with an unsigned 32-bit decimal payload, to a keyed set file\n";
+    std::cout << "  seal-tests - Encrypt test values to a compact chunked query file\n";
     std::cout << "  output_file - Path to the output sealed data file\n";
     std::cout << "  input_file  - Path to the input text file containing numbers\n";
+    std::cout << "  --key-type TYPE - Width of the values (default: int32):\n";
+    std::cout << "      int32     - Signed 32-bit decimal numbers\n";
+    std::cout << "      uint64    - Unsigned 64-bit decimal identifiers\n";
+    std::cout << "      digest128 - 128-bit digests as 32 hex digits, e.g. truncated SHA-256 of emails\n";
     std::cout << "Maximum supported values: " << MAX_VALUES << "\n";
     std::cout << "\nExample:\n";
     std::cout << "  ./value_sealer seal secret.dat numbers.txt\n";
     std::cout << "  ./value_sealer seal-tests test.dat test_numbers.txt\n";
+    std::cout << "  ./value_sealer --key-type digest128 seal secret.dat digests.txt\n";
+    std::cout << "  ./value_sealer --key-type uint64 seal-keyed scores.dat id_scores.txt\n";
 }
+
+template <typename Key> struct KeyType;
+template <> struct KeyType<int>      { static const uint16_t id = KEY_TYPE_INT32; };
+template <> struct KeyType<uint64_t> { static const uint16_t id = KEY_TYPE_UINT64; };
+template <> struct KeyType<Key128>   { static const uint16_t id = KEY_TYPE_DIGEST128; };
+
+// Parses one whitespace-separated token of the input file
+bool parse_key(const std::string& token, int& key) {
+    errno = 0;
+    char* end = nullptr;
+    long value = strtol(token.c_str(), &end, 10);
+    if (errno != 0 || *end != '\0' || value < INT32_MIN || value > INT32_MAX) {
+        return false;
+    }
+    key = static_cast<int>(value);
+    return true;
+}
+
+bool parse_key(const std::string& token, uint64_t& key) {
+    errno = 0;
+    char* end = nullptr;
+    if (token.empty() || !isdigit(static_cast<unsigned char>(token[0]))) {
+        return false;
+    }
+    key = strtoull(token.c_str(), &end, 10);
+    return errno == 0 && *end == '\0';
+}
+
+// Most significant half first, so the order of the hex strings is the key order
+bool parse_key(const std::string& token, Key128& key) {
+    if (token.size() != 32 ||
+        token.find_first_not_of("0123456789abcdefABCDEF") != std::string::npos) {
+        return false;
+    }
+    key.hi = strtoull(token.substr(0, 16).c_str(), nullptr, 16);
+    key.lo = strtoull(token.substr(16).c_str(), nullptr, 16);
+    return true;
+}
+
+bool parse_payload(const std::string& token, uint32_t& payload) {
+    errno = 0;
+    char* end = nullptr;
+    if (token.empty() || !isdigit(static_cast<unsigned char>(token[0]))) {
+        return false;
+    }
+    unsigned long long value = strtoull(token.c_str(), &end, 10);
+    if (errno != 0 || *end != '\0' || value > UINT32_MAX) {
+        return false;
+    }
+    payload = static_cast<uint32_t>(value);
+    return true;
+}
+
 bool read_or_generate_key(unsigned char* key, unsigned char* counter) {
     std::ifstream keyfile("aes.key", std::ios::binary);
     if (keyfile) {
@@ -63,45 +128,54 @@ bool read_or_generate_key(unsigned char* key, unsigned char* counter) {
     return true;
 }
 
-bool encrypt_data(const uint8_t* input, size_t input_size,
-                 std::vector<uint8_t>& output,
-                 const unsigned char* key,
-                 const unsigned char* counter) {
-    EVP_CIPHER_CTX *ctx = EVP_CIPHER_CTX_new();
-    if (!ctx) {
-        std::cerr << "Error: Failed to create cipher context\n";
+// Encrypts one chunk of a query file (see QueryFileHeader) with AES-128-GCM
+// under a fresh random IV, binding the file header and chunk index as AAD.
+// Appends the IV, tag and ciphertext to output.
+bool encrypt_query_chunk(const uint8_t* values, size_t data_size,
+                         const QueryFileHeader& header, uint32_t index,
+                         const unsigned char* key, std::vector<uint8_t>& output) {
+    unsigned char iv[QUERY_CHUNK_IV_SIZE];
+    if (RAND_bytes(iv, sizeof(iv)) != 1) {
+        std::cerr << "Error: Failed to generate chunk IV\n";
         return false;
     }
 
-    if (EVP_EncryptInit_ex(ctx, EVP_aes_128_ctr(), NULL, key, counter) != 1) {
-        std::cerr << "Error: Failed to initialize encryption\n";
-        EVP_CIPHER_CTX_free(ctx);
+    EVP_CIPHER_CTX *ctx = EVP_CIPHER_CTX_new();
+    if (!ctx) {
+        std::cerr << "Error: Failed to create cipher context\n";
         return false;
     }
 
-    output.resize(input_size + EVP_MAX_BLOCK_LENGTH);
-    int encrypted_length = 0;
-    int final_length = 0;
-
-    if (EVP_EncryptUpdate(ctx, output.data(), &encrypted_length,
-                         input, input_size) != 1) {
-        std::cerr << "Error: Failed to encrypt data\n";
-        EVP_CIPHER_CTX_free(ctx);
-        return false;
-    }
+    uint8_t aad[sizeof(QueryFileHeader) + sizeof(uint32_t)];
+    memcpy(aad, &header, sizeof(QueryFileHeader));
+    memcpy(aad + sizeof(QueryFileHeader), &index, sizeof(uint32_t));
+
+    size_t chunk_offset = output.size();
+    output.resize(chunk_offset + QUERY_CHUNK_HEADER_SIZE + data_size);
+    uint8_t* chunk = output.data() + chunk_offset;
+    memcpy(chunk, iv, QUERY_CHUNK_IV_SIZE);
+
+    int len = 0;
+    int final_len = 0;
+    bool ok = EVP_EncryptInit_ex(ctx, EVP_aes_128_gcm(), NULL, NULL, NULL) == 1 &&
+              EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_GCM_SET_IVLEN, QUERY_CHUNK_IV_SIZE, NULL) == 1 &&
+              EVP_EncryptInit_ex(ctx, NULL, NULL, key, iv) == 1 &&
+              EVP_EncryptUpdate(ctx, NULL, &len, aad, sizeof(aad)) == 1 &&
+              EVP_EncryptUpdate(ctx, chunk + QUERY_CHUNK_HEADER_SIZE, &len,
+                                values, (int)data_size) == 1 &&
+              EVP_EncryptFinal_ex(ctx, chunk + QUERY_CHUNK_HEADER_SIZE + len, &final_len) == 1 &&
+              EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_GCM_GET_TAG, QUERY_CHUNK_TAG_SIZE,
+                                  chunk + QUERY_CHUNK_IV_SIZE) == 1;
+    EVP_CIPHER_CTX_free(ctx);
 
-    if (EVP_EncryptFinal_ex(ctx, output.data() + encrypted_length, &final_length) != 1) {
-        std::cerr << "Error: Failed to finalize encryption\n";
-        EVP_CIPHER_CTX_free(ctx);
-        return false;
+    if (!ok) {
+        std::cerr << "Error: Failed to encrypt query chunk\n";
     }
-
-    EVP_CIPHER_CTX_free(ctx);
-    output.resize(encrypted_length + final_length);
-    return true;
+    return ok;
 }
 
-bool read_numbers_from_file(const std::string& filename, std::vector<int>& numbers) {
+template <typename Key>
+bool read_numbers_from_file(const std::string& filename, std::vector<Key>& numbers) {
     std::ifstream file(filename);
     if (!file) {
         std::cerr << "Error: Number of values exceeds maximum limit of " << MAX_VALUES << "\n";
@@ -127,9 +201,14 @@ bool read_numbers_from_file(const std::string& filename, std::vector<int>& numbe
         }
 
         std::istringstream iss(line);
-        int number;
+        std::string token;
 
-        while (iss >> number) {
+        while (iss >> token) {
+            Key number;
+            if (!parse_key(token, number)) {
+                std::cerr << "Error: Invalid number format at line " << line_number << ": " << line << "\n";
+                return false;
+            }
             numbers.push_back(number);
 
             if (numbers.size() > MAX_VALUES) {
@@ -137,11 +216,6 @@ bool read_numbers_from_file(const std::string& filename, std::vector<int>& numbe
                 return false;
             }
         }
-
-        if (iss.fail() && !iss.eof()) {
-            std::cerr << "Error: Invalid number format at line " << line_number << ": " << line << "\n";
-            return false;
-        }
     }
 
     if (numbers.empty()) {
@@ -153,12 +227,61 @@ bool read_numbers_from_file(const std::string& filename, std::vector<int>& numbe
     return true;
 }
 
-bool seal_values(const std::string& output_file, const std::vector<int>& values) {
-    try {
-        std::unique_ptr<SecretData> secret_data(new SecretData());
-        secret_data->version = 1;
+// Reads one "value payload" pair per line
+template <typename Key>
+bool read_pairs_from_file(const std::string& filename, std::vector<std::pair<Key, uint32_t>>& pairs) {
+    std::ifstream file(filename);
+    if (!file) {
+        std::cerr << "Error: Failed to open input file: " << filename << "\n";
+        return false;
+    }
+
+    std::string line;
+    int line_number = 0;
+    pairs.clear();
+
+    while (std::getline(file, line)) {
+        line_number++;
+
+        if (line.empty() || line[0] == '#' || line[0] == '/') {
+            continue;
+        }
+
+        std::istringstream iss(line);
+        std::string key_token;
+        std::string payload_token;
+        std::string extra;
+        if (!(iss >> key_token)) {
+            continue;
+        }
+
+        std::pair<Key, uint32_t> pair;
+        if (!(iss >> payload_token) || (iss >> extra) ||
+            !parse_key(key_token, pair.first) || !parse_payload(payload_token, pair.second)) {
+            std::cerr << "Error: Invalid value and payload at line " << line_number << ": " << line << "\n";
+            return false;
+        }
+        pairs.push_back(pair);
+
+        if (pairs.size() > MAX_VALUES) {
+            std::cerr << "Error: Number of values exceeds maximum limit of " << MAX_VALUES << "\n";
+            return false;
+        }
+    }
+
+    if (pairs.empty()) {
+        std::cerr << "Error: No valid values found in file\n";
+        return false;
+    }
 
-        std::vector<int> sorted_values = values;
+    std::cout << "Successfully read " << pairs.size() << " values with payloads from " << filename << "\n";
+    return true;
+}
+
+template <typename Key>
+bool seal_values(const std::string& output_file, const std::vector<Key>& values) {
+    try {
+        std::vector<Key> sorted_values = values;
         std::sort(sorted_values.begin(), sorted_values.end());
         sorted_values.erase(
             std::unique(sorted_values.begin(), sorted_values.end()),
@@ -170,11 +293,11 @@ bool seal_values(const std::string& output_file, const std::vector<int>& values)
                      << " duplicate values\n";
         }
 
-        secret_data->count = static_cast<uint32_t>(sorted_values.size());
-
-        for (size_t i = 0; i < sorted_values.size(); i++) {
-            secret_data->values[i] = sorted_values[i];
-        }
+        // Header followed by the count values only (see SECRET_DATA_SIZE)
+        SecretDataHeader header;
+        header.version = CURRENT_VERSION;
+        header.key_type = KeyType<Key>::id;
+        header.count = static_cast<uint32_t>(sorted_values.size());
 
         std::ofstream file(output_file, std::ios::binary);
         if (!file) {
@@ -182,7 +305,9 @@ bool seal_values(const std::string& output_file, const std::vector<int>& values)
             return false;
         }
 
-        file.write(reinterpret_cast<const char*>(secret_data.get()), sizeof(SecretData));
+        file.write(reinterpret_cast<const char*>(&header), SECRET_DATA_HEADER_SIZE);
+        file.write(reinterpret_cast<const char*>(sorted_values.data()),
+                   sorted_values.size() * sizeof(Key));
 
         if (!file) {
             std::cerr << "Error: Failed to write to output file\n";
@@ -200,16 +325,62 @@ bool seal_values(const std::string& output_file, const std::vector<int>& values)
     }
 }
 
-bool seal_test_values(const std::string& output_file, const std::vector<int>& values) {
+// Writes a keyed set file (see SECRET_DATA_VERSION_KEYED): the sorted values,
+// then their payloads in the same order. A value given twice is an error, as
+// it would have no single payload.
+template <typename Key>
+bool seal_keyed_values(const std::string& output_file, std::vector<std::pair<Key, uint32_t>> pairs) {
     try {
-        std::unique_ptr<TestData> test_data(new TestData());
-        test_data->version = 1;
-        test_data->count = static_cast<uint32_t>(values.size());
+        std::sort(pairs.begin(), pairs.end(),
+                  [](const std::pair<Key, uint32_t>& a, const std::pair<Key, uint32_t>& b) {
+                      return a.first < b.first;
+                  });
+
+        std::vector<Key> values(pairs.size());
+        std::vector<uint32_t> payloads(pairs.size());
+        for (size_t i = 0; i < pairs.size(); i++) {
+            if (i > 0 && pairs[i].first == pairs[i - 1].first) {
+                std::cerr << "Error: Value " << i << " of the sorted input is given more than once\n";
+                return false;
+            }
+            values[i] = pairs[i].first;
+            payloads[i] = pairs[i].second;
+        }
+
+        SecretDataHeader header;
+        header.version = SECRET_DATA_VERSION_KEYED;
+        header.key_type = KeyType<Key>::id;
+        header.count = static_cast<uint32_t>(values.size());
 
-        for (size_t i = 0; i < values.size(); i++) {
-            test_data->values[i] = values[i];
+        std::ofstream file(output_file, std::ios::binary);
+        if (!file) {
+            std::cerr << "Error: Failed to create output file: " << output_file << "\n";
+            return false;
+        }
+
+        file.write(reinterpret_cast<const char*>(&header), SECRET_DATA_HEADER_SIZE);
+        file.write(reinterpret_cast<const char*>(values.data()), values.size() * sizeof(Key));
+        file.write(reinterpret_cast<const char*>(payloads.data()), payloads.size() * PAYLOAD_SIZE);
+
+        if (!file) {
+            std::cerr << "Error: Failed to write to output file\n";
+            return false;
         }
 
+        file.close();
+        std::cout << "Successfully sealed " << values.size()
+                 << " values with payloads to " << output_file << "\n";
+        return true;
+    }
+    catch (const std::exception& e) {
+        std::cerr << "Error: " << e.what() << "\n";
+        return false;
+    }
+}
+
+template <typename Key>
+bool seal_test_values(const std::string& output_file, const std::vector<Key>& values) {
+    try {
         // Use existing key or generate new one if it doesn't exist
         unsigned char key[AES_KEY_SIZE];
         unsigned char counter[AES_BLOCK_SIZE];
@@ -217,28 +388,33 @@ bool seal_test_values(const std::string& output_file, const std::vector<int>& va
             return false;
         }
 
-        // Encrypt the test data
-        std::vector<uint8_t> encrypted_data;
-        if (!encrypt_data(reinterpret_cast<const uint8_t*>(test_data.get()),
-                         sizeof(TestData),
-                         encrypted_data,
-                         key,
-                         counter)) {
-            return false;
+        // Compact query file: header, then independently authenticated chunks
+        QueryFileHeader header;
+        header.magic = QUERY_FILE_MAGIC;
+        header.version = CURRENT_VERSION;
+        header.key_type = KeyType<Key>::id;
+        header.count = static_cast<uint32_t>(values.size());
+        header.chunk_values = QUERY_CHUNK_VALUES;
+
+        std::vector<uint8_t> file_data(reinterpret_cast<const uint8_t*>(&header),
+                                       reinterpret_cast<const uint8_t*>(&header) + sizeof(header));
+        uint32_t chunks = static_cast<uint32_t>(QUERY_CHUNK_COUNT(header.count, header.chunk_values));
+        for (uint32_t index = 0; index < chunks; index++) {
+            uint32_t first = index * header.chunk_values;
+            uint32_t count = std::min(header.chunk_values, header.count - first);
+            if (!encrypt_query_chunk(reinterpret_cast<const uint8_t*>(values.data() + first),
+                                     (size_t)count * sizeof(Key), header, index, key, file_data)) {
+                return false;
+            }
         }
 
-        // Write to file: counter + encrypted data
         std::ofstream file(output_file, std::ios::binary);
         if (!file) {
             std::cerr << "Error: Failed to create output file: " << output_file << "\n";
             return false;
         }
 
-        // Write counter first
-        file.write(reinterpret_cast<const char*>(counter), AES_BLOCK_SIZE);
-
-        // Write encrypted data
-        file.write(reinterpret_cast<const char*>(encrypted_data.data()), encrypted_data.size());
+        file.write(reinterpret_cast<const char*>(file_data.data()), file_data.size());
 
         if (!file) {
             std::cerr << "Error: Failed to write to output file\n";
@@ -256,22 +432,18 @@ bool seal_test_values(const std::string& output_file, const std::vector<int>& va
     }
 }
 
-int main(int argc, char* argv[]) {
-    if (argc != 4) {
-        print_usage();
-        return 1;
-    }
-
-    std::string command = argv[1];
-    std::string output_file = argv[2];
-    std::string input_file = argv[3];
-
-    if (command == "--help" || command == "-h") {
-        print_usage();
-        return 0;
+template <typename Key>
+int run_command(const std::string& command, const std::string& output_file,
+                const std::string& input_file) {
+    if (command == "seal-keyed") {
+        std::vector<std::pair<Key, uint32_t>> pairs;
+        if (!read_pairs_from_file(input_file, pairs)) {
+            return 1;
+        }
+        return seal_keyed_values(output_file, pairs) ? 0 : 1;
     }
 
-    std::vector<int> numbers;
+    std::vector<Key> numbers;
     if (!read_numbers_from_file(input_file, numbers)) {
         return 1;
     }
@@ -291,3 +463,39 @@ int main(int argc, char* argv[]) {
 
     return success ? 0 : 1;
 }
+
+int main(int argc, char* argv[]) {
+    if (argc == 2 && (std::string(argv[1]) == "--help" || std::string(argv[1]) == "-h")) {
+        print_usage();
+        return 0;
+    }
+
+    std::string key_type = "int32";
+    int first = 1;
+    if (argc == 6 && std::string(argv[1]) == "--key-type") {
+        key_type = argv[2];
+        first = 3;
+    }
+    if (argc != first + 3) {
+        print_usage();
+        return 1;
+    }
+
+    std::string command = argv[first];
+    std::string output_file = argv[first + 1];
+    std::string input_file = argv[first + 2];
+
+    if (key_type == "int32") {
+        return run_command<int>(command, output_file, input_file);
+    }
+    if (key_type == "uint64") {
+        return run_command<uint64_t>(command, output_file, input_file);
+    }
+    if (key_type == "digest128") {
+        return run_command<Key128>(command, output_file, input_file);
+    }
+
+    std::cerr << "Error: Unknown key type: " << key_type << "\n";
+    print_usage();
+    return 1;
+}